@@ -198,6 +198,7 @@ typedef enum {
 #define I2C_SENSOR_SCL      I2C2_SCL
 #define I2C_FRAMEWORK_SDA   I2C1_SDA
 #define I2C_FRAMEWORK_SCL   I2C1_SCL
+#define I2C_FRAMEWORK_ALERT PA_1
 
 
 #ifdef __cplusplus
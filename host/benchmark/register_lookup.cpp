@@ -0,0 +1,133 @@
+/*
+ * Register lookup benchmark: reads of a low and a high user register and of built-in registers are timed in host time,
+ * first with only the timed user registers, then with every register slot used. Lookup goes through the register-indexed
+ * slot table, so the time per read depends neither on the register nor on the number of registers.
+ * Registers are read in turn for ROUNDS rounds and the fastest round is kept, so host scheduling noise is left out.
+ * Results are printed as JSON so runs of two commits can be compared.
+ *
+ * Usage: sim-lookup-benchmark [reads per register]
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include <chrono>
+#include <cstdlib>
+
+#define NODE_ADDRESS (0x20)
+#define LOW_USER_REG (0x00)
+#define HIGH_USER_REG (0xFE)
+#define DEFAULT_READS (20000)
+#define ROUNDS (10)
+
+// Registers timed, all read with the same length so only the lookup differs
+// User registers are set by the benchmark, built-in registers by the framework
+struct lookup_register_t{
+    const char *name;
+    uint8_t reg;
+    int length;
+};
+
+static const lookup_register_t lookup_registers[] = {
+    {"low_user", LOW_USER_REG, 4},
+    {"high_user", HIGH_USER_REG, 4},
+    {"builtin_data", UID_REG, 4},
+    {"builtin_read", STREAM_STATUS_REG, 4},
+};
+
+static char user_value[4] = {0x11, 0x22, 0x33, 0x44};
+
+static char *read_user()
+{
+    return user_value;
+}
+
+// Free for user registers, built-in registers are kept
+static bool is_user_register(int reg)
+{
+    return reg < FIRMWARE_REG || reg > BUS_HEALTH_REG;
+}
+
+// Host ns per read of each register, on a node with every register slot or only the timed user registers used
+static void run(bool all_registers, int reads, double *ns_per_read)
+{
+    sim::clear_bus_nodes();
+    sim::flash_erase_all();
+    sim::set_uid(0xCAFE0001);
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    // Timed registers first, then others until the slots are used
+    node.add_i2c_callback(LOW_USER_REG, &read_user, nullptr, sizeof(user_value));
+    node.add_i2c_callback(HIGH_USER_REG, &read_user, nullptr, sizeof(user_value));
+    int slots = 2;
+    for(int reg = 0; reg < I2C_REGISTER_COUNT && all_registers && slots < I2C_USER_REGISTER_SLOTS; reg++){
+        if(is_user_register(reg) && reg != LOW_USER_REG && reg != HIGH_USER_REG){
+            node.add_i2c_callback(reg, &read_user, nullptr, sizeof(user_value));
+            slots++;
+        }
+    }
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    char data[I2C_BUFFER_SIZE];
+    sim::assign_address(0xCAFE0001, NODE_ADDRESS);
+    node.flush_metadata();
+
+    int round_reads = reads / ROUNDS > 0 ? reads / ROUNDS : 1;
+    for(int round = 0; round < ROUNDS; round++){
+        for(size_t i = 0; i < sizeof(lookup_registers) / sizeof(lookup_registers[0]); i++){
+            const lookup_register_t &entry = lookup_registers[i];
+            auto start = std::chrono::steady_clock::now();
+            for(int n = 0; n < round_reads; n++){
+                sim::master_read_register(NODE_ADDRESS, entry.reg, data, entry.length);
+            }
+            auto time = std::chrono::steady_clock::now() - start;
+            double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() / round_reads;
+            if(round == 0 || ns < ns_per_read[i]){
+                ns_per_read[i] = ns;
+            }
+        }
+    }
+
+    sim::clear_bus_nodes();
+}
+
+int main(int argc, char **argv)
+{
+    int reads = argc > 1 ? atoi(argv[1]) : DEFAULT_READS;
+    if(reads <= 0){
+        fprintf(stderr, "usage: %s [reads per register]\n", argv[0]);
+        return 1;
+    }
+
+    const int count = sizeof(lookup_registers) / sizeof(lookup_registers[0]);
+    double few[count];
+    double all[count];
+    run(false, reads, few);
+    run(true, reads, all);
+
+    // Spread of all times, close to 1 when lookup cost is the same for every register and table size
+    double min = few[0];
+    double max = few[0];
+    for(int i = 0; i < count; i++){
+        min = few[i] < min ? few[i] : min;
+        min = all[i] < min ? all[i] : min;
+        max = few[i] > max ? few[i] : max;
+        max = all[i] > max ? all[i] : max;
+    }
+
+    printf("{\n");
+    printf("  \"benchmark\": \"register_lookup\",\n");
+    printf("  \"reads_per_register\": %d,\n", reads);
+    printf("  \"registers\": {\n");
+    for(int i = 0; i < count; i++){
+        printf("    \"%s\": {\"register\": %d, \"host_ns_per_read_few_registers\": %.1f, \"host_ns_per_read_all_registers\": %.1f}%s\n",
+               lookup_registers[i].name, lookup_registers[i].reg, few[i], all[i], i + 1 < count ? "," : "");
+    }
+    printf("  },\n");
+    printf("  \"max_over_min\": %.2f\n", max / min);
+    printf("}\n");
+
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * Trace replay benchmark: master transactions of a trace are replayed against a node and timed per transaction type,
+ * in host time (framework code, loop_iteration() included) and in simulated bus and flash time.
+ * Results are printed as JSON so runs of two commits can be compared.
+ *
+ * Usage: sim-benchmark [trace file] [iterations]
+ * Without a trace file a synthetic trace is generated, "-" as trace file prints it in the trace format instead.
+ *
+ * Trace format, one transaction per line, bytes in hex, # starts a comment:
+ *   <type> write <address> <bytes>...           write of the bytes (register first), address 0 is the general call
+ *   <type> read <address> <register> <length>   register read with a repeated start
+ *   <type> idle <us>                            time without transaction, the node runs its background work
+ * <type> is the name results are grouped by.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#define NODE_ADDRESS (0x20)
+#define CALLBACK_REG_COUNT (0x80)
+#define MAP_FIRST_REG (0x80)
+#define SNAPSHOT_REG (0x90)
+#define BANK_FIRST_REG (0x98)
+#define BANK_SIZE (8)
+#define SYNTHETIC_TRANSACTIONS (2000)
+#define DEFAULT_ITERATIONS (20)
+
+// Transaction of a trace
+struct trace_entry_t{
+    std::string type;
+    char op;
+    int address;
+    std::vector<char> data;
+    int length;
+};
+
+// Results of a transaction type
+struct result_t{
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t host_ns;
+    uint64_t sim_us;
+};
+
+// Large callback table, one value per register
+static char callback_values[CALLBACK_REG_COUNT][4];
+static uint8_t callback_register;
+
+static char *read_callback()
+{
+    return callback_values[callback_register];
+}
+
+static int write_callback(char *buffer)
+{
+    // Register alone, keep it for the next read
+    callback_register = (uint8_t) buffer[0] % CALLBACK_REG_COUNT;
+    if(buffer[1] == 0 && buffer[2] == 0 && buffer[3] == 0 && buffer[4] == 0){
+        return callback_register;
+    }
+    memcpy(callback_values[callback_register], &buffer[1], 4);
+    return 0;
+}
+
+// RAM register bank
+static char bank[BANK_SIZE];
+
+// Registers of a register map
+class Device
+{
+public:
+    int read_value(i2c_span_t data)
+    {
+        memcpy(data.data, &value, sizeof(value));
+        return sizeof(value);
+    }
+
+    int write_value(i2c_span_t data)
+    {
+        // Register alone, keep it for the next read
+        if(data.size < (int) sizeof(value)){
+            return MAP_FIRST_REG;
+        }
+        memcpy(&value, data.data, sizeof(value));
+        return 0;
+    }
+
+private:
+    uint32_t value = 0;
+};
+
+static constexpr i2c_register_handler_t<Device> device_map[] = {
+    {MAP_FIRST_REG, &Device::read_value, &Device::write_value, 4},
+    {MAP_FIRST_REG + 1, &Device::read_value, nullptr, 4},
+    {MAP_FIRST_REG + 2, &Device::read_value, nullptr, 4},
+    {MAP_FIRST_REG + 3, &Device::read_value, nullptr, 4},
+};
+
+// Deterministic generator, traces are the same from one run to the next
+static uint32_t random_state = 0x12345678;
+
+static uint32_t next_random()
+{
+    random_state = random_state * 1664525 + 1013904223;
+    return random_state >> 8;
+}
+
+static void add_write(std::vector<trace_entry_t> &trace, const char *type, int address, std::vector<char> data)
+{
+    trace.push_back({type, 'w', address, data, 0});
+}
+
+static void add_read(std::vector<trace_entry_t> &trace, const char *type, int address, uint8_t reg, int length)
+{
+    trace.push_back({type, 'r', address, std::vector<char>(1, (char) reg), length});
+}
+
+// Mix of the transactions of a running system
+static void generate_trace(std::vector<trace_entry_t> &trace)
+{
+    for(int i = 0; i < SYNTHETIC_TRANSACTIONS; i++){
+        uint32_t pick = next_random() % 100;
+        uint8_t reg = next_random() % CALLBACK_REG_COUNT;
+        if(pick < 30){
+            add_read(trace, "callback_read", NODE_ADDRESS, reg, 4);
+        } else if(pick < 45){
+            std::vector<char> data = {(char) reg, (char) i, (char) (i >> 8), 1, 2};
+            add_write(trace, "callback_write", NODE_ADDRESS, data);
+        } else if(pick < 60){
+            add_read(trace, "map_read", NODE_ADDRESS, MAP_FIRST_REG + next_random() % 4, 4);
+        } else if(pick < 65){
+            std::vector<char> data = {(char) MAP_FIRST_REG, (char) i, 0, 0, 0};
+            add_write(trace, "map_write", NODE_ADDRESS, data);
+        } else if(pick < 70){
+            add_read(trace, "snapshot_read", NODE_ADDRESS, SNAPSHOT_REG, 8);
+        } else if(pick < 75){
+            add_read(trace, "bank_read", NODE_ADDRESS, BANK_FIRST_REG, BANK_SIZE);
+        } else if(pick < 83){
+            uint8_t builtin[] = {UID_REG, VERSION_HASH_REG, BUS_SPEED_REG, SYNC_REG, FIFO_LEVEL_REG, BUS_HEALTH_REG};
+            uint8_t builtin_reg = builtin[next_random() % sizeof(builtin)];
+            add_read(trace, "builtin_read", NODE_ADDRESS, builtin_reg, builtin_reg == VERSION_HASH_REG ? 32 : 4);
+        } else if(pick < 87){
+            std::vector<char> data(33, 0);
+            data[0] = NAME_REG;
+            snprintf(&data[1], 32, "node %d", i);
+            add_write(trace, "metadata_write", NODE_ADDRESS, data);
+        } else if(pick < 91){
+            std::vector<char> data = {GENERAL_CALL_GROUP_WRITE_CMD, GENERAL_CALL_ALL_GROUPS, (char) MAP_FIRST_REG, (char) i, 0, 0, 0};
+            add_write(trace, "general_call_group_write", 0, data);
+        } else if(pick < 95){
+            std::vector<char> data = {GENERAL_CALL_SYNC_LATCH_CMD};
+            add_write(trace, "general_call_sync_latch", 0, data);
+        } else {
+            trace.push_back({"idle", 'i', 0, {}, (int) (next_random() % 50000)});
+        }
+    }
+    // Pending metadata saved within the trace
+    trace.push_back({"idle", 'i', 0, {}, 2 * METADATA_COMMIT_DELAY_MS * 1000});
+}
+
+static int load_trace(const char *path, std::vector<trace_entry_t> &trace)
+{
+    std::ifstream file(path);
+    if(!file){
+        return -1;
+    }
+
+    std::string line;
+    while(std::getline(file, line)){
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        trace_entry_t entry;
+        std::string op;
+        if(!(fields >> entry.type >> op)){
+            continue;
+        }
+        entry.op = op[0];
+        entry.address = 0;
+        entry.length = 0;
+        unsigned int value;
+        if(entry.op == 'i'){
+            fields >> entry.length;
+        } else {
+            fields >> std::hex >> value;
+            entry.address = value;
+            while(fields >> value){
+                entry.data.push_back((char) value);
+            }
+            if(entry.op == 'r'){
+                // Last field is the length
+                if(entry.data.size() < 2){
+                    return -1;
+                }
+                entry.length = (uint8_t) entry.data.back();
+                entry.data.resize(1);
+            }
+        }
+        trace.push_back(entry);
+    }
+    return 0;
+}
+
+static void print_trace(const std::vector<trace_entry_t> &trace)
+{
+    for(const trace_entry_t &entry : trace){
+        if(entry.op == 'i'){
+            printf("%s idle %d\n", entry.type.c_str(), entry.length);
+            continue;
+        }
+        printf("%s %s %02x", entry.type.c_str(), entry.op == 'r' ? "read" : "write", entry.address);
+        for(char byte : entry.data){
+            printf(" %02x", (uint8_t) byte);
+        }
+        if(entry.op == 'r'){
+            printf(" %02x", entry.length);
+        }
+        printf("\n");
+    }
+}
+
+static void replay(const trace_entry_t &entry, std::map<std::string, result_t> *results)
+{
+    char data[I2C_RX_BUFFER_SIZE];
+    uint32_t sim_start = sim::now_us();
+    auto host_start = std::chrono::steady_clock::now();
+
+    int bytes = 0;
+    if(entry.op == 'w'){
+        sim::master_write(entry.address, entry.data.data(), entry.data.size());
+        bytes = entry.data.size();
+    } else if(entry.op == 'r'){
+        int length = entry.length < (int) sizeof(data) ? entry.length : sizeof(data);
+        sim::master_read_register(entry.address, entry.data[0], data, length);
+        bytes = 1 + length;
+    } else {
+        sim::advance_us(entry.length);
+        sim::run_bus_nodes();
+    }
+
+    auto host_time = std::chrono::steady_clock::now() - host_start;
+    if(results != nullptr){
+        result_t &result = (*results)[entry.type];
+        result.count++;
+        result.bytes += bytes;
+        result.host_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(host_time).count();
+        result.sim_us += sim::now_us() - sim_start;
+    }
+}
+
+static void print_result(const char *name, const result_t &result, bool last)
+{
+    double ns_per_transaction = result.count > 0 ? (double) result.host_ns / result.count : 0;
+    printf("    \"%s\": {\"count\": %llu, \"bytes\": %llu, \"host_ns_per_transaction\": %.1f, \"host_transactions_per_second\": %.0f, \"sim_us_per_transaction\": %.1f}%s\n",
+           name, (unsigned long long) result.count, (unsigned long long) result.bytes, ns_per_transaction,
+           ns_per_transaction > 0 ? 1e9 / ns_per_transaction : 0, result.count > 0 ? (double) result.sim_us / result.count : 0, last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<trace_entry_t> trace;
+    if(argc > 1 && strcmp(argv[1], "-") != 0){
+        if(load_trace(argv[1], trace) != 0){
+            fprintf(stderr, "cannot read trace %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        generate_trace(trace);
+        if(argc > 1){
+            print_trace(trace);
+            return 0;
+        }
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    // Node with a large callback table, a register map, a snapshot, a register bank and the built-in registers
+    sim::set_uid(0xCAFE0023);
+    static Device device;
+    static I2CSnapshot<uint64_t> snapshot;
+    uint64_t snapshot_value = 0x0123456789ABCDEF;
+    snapshot.publish(snapshot_value);
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    for(int reg = 0; reg < CALLBACK_REG_COUNT; reg++){
+        node.add_i2c_callback(reg, &read_callback, &write_callback, 4);
+    }
+    node.add_i2c_register_map<decltype(device_map), device_map>(&device);
+    node.add_i2c_snapshot(SNAPSHOT_REG, &snapshot);
+    node.add_i2c_register_bank(BANK_FIRST_REG, bank, BANK_SIZE);
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    sim::assign_address(0xCAFE0023, NODE_ADDRESS);
+    node.flush_metadata();
+
+    // First pass warms up caches and is not counted
+    for(const trace_entry_t &entry : trace){
+        replay(entry, nullptr);
+    }
+
+    std::map<std::string, result_t> results;
+    sim::flash_reset_stats();
+    for(int i = 0; i < iterations; i++){
+        for(const trace_entry_t &entry : trace){
+            replay(entry, &results);
+        }
+    }
+
+    result_t total = {0, 0, 0, 0};
+    result_t transactions = {0, 0, 0, 0};
+    for(const auto &result : results){
+        total.count += result.second.count;
+        total.bytes += result.second.bytes;
+        total.host_ns += result.second.host_ns;
+        total.sim_us += result.second.sim_us;
+        if(result.first != "idle"){
+            transactions.count += result.second.count;
+            transactions.bytes += result.second.bytes;
+            transactions.host_ns += result.second.host_ns;
+            transactions.sim_us += result.second.sim_us;
+        }
+    }
+
+    sim::flash_stats_t flash = sim::flash_stats();
+    printf("{\n");
+    printf("  \"benchmark\": \"trace_replay\",\n");
+    printf("  \"trace\": \"%s\",\n", argc > 1 ? argv[1] : "synthetic");
+    printf("  \"trace_entries\": %d,\n", (int) trace.size());
+    printf("  \"iterations\": %d,\n", iterations);
+    printf("  \"flash\": {\"erase_count\": %u, \"program_count\": %u, \"busy_time_us\": %llu},\n", flash.erase_count, flash.program_count, (unsigned long long) flash.busy_time_us);
+    printf("  \"types\": {\n");
+    int index = 0;
+    for(const auto &result : results){
+        print_result(result.first.c_str(), result.second, ++index == (int) results.size());
+    }
+    printf("  },\n");
+    printf("  \"summary\": {\n");
+    print_result("transactions", transactions, false);
+    print_result("total", total, true);
+    printf("  }\n");
+    printf("}\n");
+
+    return 0;
+}
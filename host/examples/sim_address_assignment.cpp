@@ -0,0 +1,116 @@
+/*
+ * Address resolution of a bus of simulated nodes: the master repeatedly reads ARP_ADDRESS, gets the lowest
+ * unassigned UID by arbitration and assigns it the next free address.
+ * The nodes are then split in two groups and a group is renamed by addressed writes, then by a single group write.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include <memory>
+#include <set>
+
+#define NODE_COUNT (60)
+#define FIRST_ADDRESS (0x10)
+
+int main()
+{
+    std::vector<std::unique_ptr<I2C_Framework>> nodes;
+
+    // Unique IDs close to each other, the case where random addresses collide
+    for(int i = 0; i < NODE_COUNT; i++){
+        sim::set_uid(0x20230000 + i * 95);
+        nodes.emplace_back(new I2C_Framework(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL));
+    }
+
+    uint32_t boot_time = sim::now_us();
+    for(std::unique_ptr<I2C_Framework> &node : nodes){
+        node->init();
+    }
+
+    for(std::unique_ptr<I2C_Framework> &node : nodes){
+        I2C_Framework *framework = node.get();
+        sim::add_bus_node([framework]() {
+            framework->loop_iteration();
+        });
+    }
+
+    // Master side of the address resolution
+    int address = FIRST_ADDRESS;
+    int assigned = 0;
+    uint32_t uid;
+    while(sim::read_arp_uid(&uid) == 0){
+        // Skip addresses already used on the bus
+        char probe;
+        while(sim::master_read(address, &probe, 1) == 0){
+            address++;
+        }
+
+        sim::assign_address(uid, address);
+        assigned++;
+        address++;
+    }
+    uint32_t assignment_time = sim::now_us() - boot_time;
+
+    // Every node must answer alone on its address with its own UID
+    std::set<uint32_t> uids;
+    for(int node_address = FIRST_ADDRESS; node_address < address; node_address++){
+        char data[4];
+        if(sim::master_read_register(node_address, UID_REG, data, 4) == 0){
+            uint32_t node_uid;
+            memcpy(&node_uid, data, 4);
+            uids.insert(node_uid);
+        }
+    }
+
+    printf("assigned: %d, distinct UIDs read back: %d, slaves on bus: %d\n", assigned, (int) uids.size(), sim::slave_count());
+    printf("boot to addressable: %u us\n", assignment_time);
+    sim::check(assigned == NODE_COUNT && uids.size() == NODE_COUNT, "every node answers alone on its own address");
+
+    // All nodes in group 1 with one group write, then the second half moved to group 2
+    const char group_all[] = {GENERAL_CALL_GROUP_WRITE_CMD, GENERAL_CALL_ALL_GROUPS, (char) GROUP_REG, 1};
+    sim::master_write(0, group_all, sizeof(group_all));
+    const char group_two[] = {(char) GROUP_REG, 2};
+    for(int node_address = FIRST_ADDRESS + NODE_COUNT / 2; node_address < address; node_address++){
+        sim::master_write(node_address, group_two, sizeof(group_two));
+    }
+
+    // Let nodes commit metadata before timing transactions
+    auto settle = []() {
+        sim::advance_us(METADATA_COMMIT_DELAY_MS * 1000);
+        sim::run_bus_nodes();
+    };
+
+    // Rename group 2, one transaction per node
+    settle();
+    char name_write[1 + 32] = {(char) NAME_REG};
+    strcpy(&name_write[1], "addressed");
+    uint32_t start = sim::now_us();
+    int transactions = 0;
+    for(int node_address = FIRST_ADDRESS + NODE_COUNT / 2; node_address < address; node_address++){
+        sim::master_write(node_address, name_write, sizeof(name_write));
+        transactions++;
+    }
+    printf("addressed writes: %d transactions, %u us\n", transactions, sim::now_us() - start);
+
+    // Same with a single group write
+    char group_write[2 + sizeof(name_write)] = {GENERAL_CALL_GROUP_WRITE_CMD, 2};
+    memcpy(&group_write[2], name_write, sizeof(name_write));
+    strcpy(&group_write[3], "multicast");
+    settle();
+    start = sim::now_us();
+    sim::master_write(0, group_write, sizeof(group_write));
+    printf("group write: 1 transaction, %u us\n", sim::now_us() - start);
+
+    int renamed = 0;
+    int untouched = 0;
+    for(int node_address = FIRST_ADDRESS; node_address < address; node_address++){
+        char name[32];
+        sim::master_read_register(node_address, NAME_REG, name, sizeof(name));
+        renamed += strcmp(name, "multicast") == 0;
+        untouched += node_address < FIRST_ADDRESS + NODE_COUNT / 2 && strcmp(name, "multicast") != 0;
+    }
+    printf("group 2 renamed: %d, group 1 untouched: %d\n", renamed, untouched);
+    sim::check(renamed == NODE_COUNT / 2 && untouched == NODE_COUNT / 2, "group write reaches only its group");
+
+    return sim::test_result();
+}
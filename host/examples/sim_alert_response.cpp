@@ -0,0 +1,67 @@
+/*
+ * SMBus alert response in interrupt mode: two nodes assert ALERT#, the master reads ALERT_RESPONSE_ADDRESS and
+ * arbitration leaves the lower address. The other node lost arbitration, which is not a bus error: it keeps ALERT#
+ * asserted and its bus speed, and answers the next alert response read.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include <memory>
+
+#define FIRST_ADDRESS (0x30)
+#define NODE_COUNT (2)
+
+int main()
+{
+    std::unique_ptr<I2C_Framework> nodes[NODE_COUNT];
+    for(int i = 0; i < NODE_COUNT; i++){
+        sim::set_uid(0xCAFE0140 + i);
+        nodes[i].reset(new I2C_Framework(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL));
+        nodes[i]->init();
+        I2C_Framework *node = nodes[i].get();
+        sim::add_bus_node([node]() {
+            node->loop_iteration();
+        });
+    }
+
+    for(int i = 0; i < NODE_COUNT; i++){
+        sim::assign_address(0xCAFE0140 + i, FIRST_ADDRESS + i);
+        nodes[i]->flush_metadata();
+    }
+
+    // Fast-mode on every node, a bus error would bring a node back to Standard-mode
+    const char bus_mode[] = {GENERAL_CALL_BUS_MODE_CMD, BUS_MODE_FAST};
+    sim::master_write(0, bus_mode, sizeof(bus_mode));
+    sim::run_bus_nodes();
+
+    for(int i = 0; i < NODE_COUNT; i++){
+        nodes[i]->raise_alert(ALERT_DATA_READY);
+    }
+    sim::run_bus_nodes();
+
+    // Lowest address first, then the node which lost arbitration, then nobody
+    for(int i = 0; i < NODE_COUNT; i++){
+        char response = 0;
+        int rc = sim::master_read(SIM_ALERT_RESPONSE_ADDRESS, &response, 1);
+        printf("alert response %d: rc %d, address 0x%02x\n", i, rc, (uint8_t) response >> 1);
+        sim::check(rc == 0 && (uint8_t) response >> 1 == FIRST_ADDRESS + i, "alerting nodes answer from the lowest address");
+    }
+    char response;
+    int rc = sim::master_read(SIM_ALERT_RESPONSE_ADDRESS, &response, 1);
+    printf("alert response once released: rc %d\n", rc);
+    sim::check(rc != 0, "ALERT# released by every node which answered");
+
+    // Bus mode changes are applied from the main loop
+    sim::run_bus_nodes();
+
+    for(int i = 0; i < NODE_COUNT; i++){
+        I2C_Framework::bus_health_t health;
+        nodes[i]->get_bus_health(&health);
+        char speed[BUS_SPEED_SIZE];
+        sim::master_read_register(FIRST_ADDRESS + i, BUS_SPEED_REG, speed, sizeof(speed));
+        printf("node 0x%02x: %d bus errors, bus mode %d\n", FIRST_ADDRESS + i, health.bus_error_count, speed[1]);
+        sim::check(health.bus_error_count == 0 && speed[1] == BUS_MODE_FAST, "lost arbitration is not a bus error");
+    }
+
+    return sim::test_result();
+}
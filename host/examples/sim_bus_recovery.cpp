@@ -0,0 +1,145 @@
+/*
+ * Stuck bus: another device holds SDA, then SCL, low. The node sees it after BUS_STUCK_TIMEOUT_MS, drops the
+ * transaction and sets its I2C peripheral up again without a reset, then answers as soon as the line is released.
+ * A device holding a line for good makes the recovery fail, its error is withdrawn once the line is released.
+ * A device stopped in the middle of a byte lets SDA go on the recovery clocks, the recovery then succeeds.
+ * The recovery ends with a STOP only when SDA was held, a free SDA is left alone.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+#define HOLD_TIME_MS (40)
+#define SAMPLE_REG (0x10)
+
+#define RELEASE_CLOCKS (3)
+
+static I2C_Framework *node;
+static char sample[2] = {0x12, 0x34};
+static int clocks_to_release;
+static int led_while_held;
+static int sda_driven_low;
+
+static char *read_sample()
+{
+    return sample;
+}
+
+// Hold a line low for HOLD_TIME_MS, loop running every ms, return the ms until the first recovery attempt
+static int hold_line(PinName pin)
+{
+    I2C_Framework::bus_health_t before;
+    I2C_Framework::bus_health_t health;
+    node->get_bus_health(&before);
+
+    // SDA pulled low by the node, as for a STOP
+    sda_driven_low = 0;
+    sim::set_pin_hook([](PinName pin, int level) {
+        if(pin == I2C_FRAMEWORK_SDA && level == 0){
+            sda_driven_low++;
+        }
+    });
+
+    int detection_ms = -1;
+    sim::set_pin(pin, 0);
+    for(int ms = 1; ms <= HOLD_TIME_MS; ms++){
+        sim::advance_us(1000);
+        sim::run_bus_nodes();
+        node->get_bus_health(&health);
+        if(detection_ms < 0 && health.recovery_count + health.failed_recovery_count != before.recovery_count + before.failed_recovery_count){
+            detection_ms = ms;
+        }
+    }
+    led_while_held = sim::get_pin(LED_STATUS);
+    sim::set_pin(pin, 1);
+    sim::set_pin_hook(nullptr);
+    sim::run_bus_nodes();
+    return detection_ms;
+}
+
+// Device holding SDA low until it sees RELEASE_CLOCKS falling edges on SCL, return the ms until it is released
+static int hold_sda_until_clocked()
+{
+    clocks_to_release = RELEASE_CLOCKS;
+    sda_driven_low = 0;
+    sim::set_pin_hook([](PinName pin, int level) {
+        if(pin == I2C_FRAMEWORK_SCL && level == 0 && clocks_to_release > 0 && --clocks_to_release == 0){
+            sim::set_pin(I2C_FRAMEWORK_SDA, 1);
+        }
+        if(pin == I2C_FRAMEWORK_SDA && level == 0){
+            sda_driven_low++;
+        }
+    });
+
+    int release_ms = -1;
+    sim::set_pin(I2C_FRAMEWORK_SDA, 0);
+    for(int ms = 1; ms <= HOLD_TIME_MS && release_ms < 0; ms++){
+        sim::advance_us(1000);
+        sim::run_bus_nodes();
+        if(sim::get_pin(I2C_FRAMEWORK_SDA) == 1){
+            release_ms = ms;
+        }
+    }
+    sim::set_pin(I2C_FRAMEWORK_SDA, 1);
+    sim::set_pin_hook(nullptr);
+    sim::run_bus_nodes();
+    return release_ms;
+}
+
+static void print_bus_health(int address)
+{
+    char health[BUS_HEALTH_SIZE];
+    sim::master_read_register(address, BUS_HEALTH_REG, health, sizeof(health));
+    uint16_t counters[BUS_HEALTH_SIZE / 2];
+    memcpy(counters, health, sizeof(health));
+    printf("bus health: SCL stuck %d, SDA stuck %d, timeouts %d, bus errors %d, recoveries %d, failed %d, last %d us\n",
+           counters[0], counters[1], counters[2], counters[3], counters[4], counters[5], counters[6]);
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0021);
+    node = new I2C_Framework(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node->add_i2c_callback(SAMPLE_REG, &read_sample, nullptr, sizeof(sample));
+    node->init();
+    sim::add_bus_node([]() {
+        node->loop_iteration();
+    });
+
+    int address = 0x30;
+    char data[I2C_BUFFER_SIZE];
+    sim::assign_address(0xCAFE0021, address);
+    node->flush_metadata();
+
+    int detection_ms = hold_line(I2C_FRAMEWORK_SDA);
+    printf("SDA held %d ms: recovery after %d ms, LED while held %d\n", HOLD_TIME_MS, detection_ms, led_while_held);
+    sim::check(detection_ms >= BUS_STUCK_TIMEOUT_MS && detection_ms < HOLD_TIME_MS && led_while_held == 1, "stuck SDA seen after the timeout, failed recovery lights the LED");
+    detection_ms = hold_line(I2C_FRAMEWORK_SCL);
+    printf("SCL held %d ms: recovery after %d ms, LED while held %d, SDA driven low %d times\n", HOLD_TIME_MS, detection_ms, led_while_held, sda_driven_low);
+    sim::check(detection_ms >= BUS_STUCK_TIMEOUT_MS && detection_ms < HOLD_TIME_MS && led_while_held == 1, "stuck SCL seen after the timeout, failed recovery lights the LED");
+    sim::check(sda_driven_low == 0, "no STOP while SDA is free");
+
+    // Served right after the release, no watchdog reset
+    int rc = sim::master_read_register(address, SAMPLE_REG, data, sizeof(sample));
+    printf("read after release: rc %d, data 0x%02x%02x, watchdog expired %d\n", rc, (uint8_t) data[0], (uint8_t) data[1], sim::watchdog_expired());
+    sim::check(rc == 0 && memcmp(data, sample, sizeof(sample)) == 0 && !sim::watchdog_expired(), "served after the release without a reset");
+
+    // Recoveries failed while the lines were held, their error is gone now that both lines are high
+    char status[1];
+    sim::master_read_register(address, ALERT_STATUS_REG, status, sizeof(status));
+    printf("error after release: LED %d, alert status 0x%02x\n", sim::get_pin(LED_STATUS), (uint8_t) status[0]);
+    sim::check(sim::get_pin(LED_STATUS) == 0 && (status[0] & ALERT_ERROR) == 0, "error withdrawn once the lines are released");
+    print_bus_health(address);
+
+    // Recovery clocks free SDA, no error left behind
+    int release_ms = hold_sda_until_clocked();
+    printf("SDA held until %d clocks: released after %d ms, SDA driven low %d times\n", RELEASE_CLOCKS, release_ms, sda_driven_low);
+    sim::check(release_ms >= BUS_STUCK_TIMEOUT_MS && release_ms < HOLD_TIME_MS, "recovery clocks free SDA");
+    sim::check(sda_driven_low == 1, "STOP once SDA is freed");
+    sim::master_read_register(address, ALERT_STATUS_REG, status, sizeof(status));
+    printf("error after recovery: LED %d, alert status 0x%02x\n", sim::get_pin(LED_STATUS), (uint8_t) status[0]);
+    sim::check(sim::get_pin(LED_STATUS) == 0 && (status[0] & ALERT_ERROR) == 0, "no error after a successful recovery");
+    print_bus_health(address);
+
+    return sim::test_result();
+}
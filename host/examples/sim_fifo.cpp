@@ -0,0 +1,143 @@
+/*
+ * Sample FIFO: the node samples at 1 kHz, the master first polls every sample from a register,
+ * then drains batches of timestamped samples from FIFO_DRAIN_REG periodically and on ALERT#,
+ * and compares bus transactions per sample.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+#define SAMPLE_COUNT (1000)
+#define SAMPLE_PERIOD_US (1000)
+// Idle time between drains, a full drain takes about 12 ms at 100 kHz
+#define DRAIN_PERIOD_US (2000)
+
+static char fifo_storage[512];
+
+static uint32_t get_uint32(const char *data)
+{
+    return (uint8_t) data[0] | (uint8_t) data[1] << 8 | (uint8_t) data[2] << 16 | (uint32_t) (uint8_t) data[3] << 24;
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0044);
+
+    RingBuffer fifo(fifo_storage, sizeof(fifo_storage));
+    I2CSnapshot<int32_t> latest_sample;
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL, I2C_FRAMEWORK_ALERT);
+    node.set_sample_fifo(&fifo, sizeof(int32_t));
+    node.add_i2c_snapshot(0x10, &latest_sample);
+    node.init();
+
+    // Application side: one sample per period, pushed in the FIFO and published in the register
+    int32_t sample = 0;
+    uint32_t next_sample_time = 0;
+    sim::add_bus_node([&]() {
+        node.loop_iteration();
+
+        while((int32_t) (sim::now_us() - next_sample_time) >= 0){
+            latest_sample.publish(sample);
+            node.push_sample(&sample);
+            sample++;
+            next_sample_time += SAMPLE_PERIOD_US;
+        }
+    });
+
+    // Assign an address to the node through address resolution
+    int address = 0x20;
+    char data[I2C_STREAM_FRAME_SIZE];
+    sim::assign_address(0xCAFE0044, address);
+
+    // Polling every sample
+    sim::run_bus_nodes();
+    next_sample_time = sim::now_us();
+    int transactions = 0;
+    int received = 0;
+    int32_t last = -1;
+    while(received < SAMPLE_COUNT){
+        sim::master_read_register(address, 0x10, data, 4);
+        transactions++;
+        int32_t value = get_uint32(data);
+        if(value != last){
+            received++;
+            last = value;
+        }
+        sim::advance_us(100);
+    }
+    printf("polling: %d samples in %d transactions, %.2f per sample\n", received, transactions, (double) transactions / received);
+
+    // Drop samples pushed while polling, until a drain is not full
+    char select = FIFO_DRAIN_REG;
+    int batch = (I2C_STREAM_FRAME_SIZE - 1) / (I2C_FIFO_TIMESTAMP_SIZE + 4);
+    sim::master_write(address, &select, 1);
+    do{
+        sim::master_read(address, data, sizeof(data));
+        if(data[0] > 0){
+            last = get_uint32(&data[1 + (data[0] - 1) * (I2C_FIFO_TIMESTAMP_SIZE + 4) + I2C_FIFO_TIMESTAMP_SIZE]);
+        }
+    } while(data[0] == batch);
+
+    // Check records of a drain follow the previous ones
+    int errors = 0;
+    uint32_t last_timestamp = 0;
+    auto check_drain = [&]() {
+        int count = (uint8_t) data[0];
+        for(int i = 0; i < count; i++){
+            const char *record = &data[1 + i * (I2C_FIFO_TIMESTAMP_SIZE + 4)];
+            uint32_t timestamp = get_uint32(record);
+            int32_t value = get_uint32(&record[I2C_FIFO_TIMESTAMP_SIZE]);
+            if(value != last + 1 || (received > 0 && (int32_t) (timestamp - last_timestamp) < 0)){
+                errors++;
+            }
+            last = value;
+            last_timestamp = timestamp;
+            received++;
+        }
+    };
+
+    // Draining batches
+    transactions = 0;
+    received = 0;
+    while(received < SAMPLE_COUNT){
+        sim::advance_us(DRAIN_PERIOD_US);
+        sim::run_bus_nodes();
+        sim::master_read(address, data, sizeof(data));
+        transactions++;
+        check_drain();
+    }
+    printf("fifo: %d samples in %d transactions, %.2f per sample, %d errors\n", received, transactions, (double) transactions / received, errors);
+    sim::check(errors == 0 && transactions < received, "drained batches in order, fewer transactions than samples");
+
+    // Draining when the node pulls ALERT#, the master does not poll the bus at all in between
+    const char watermark[] = {(char) FIFO_WATERMARK_REG, 32, 0};
+    sim::master_write(address, watermark, sizeof(watermark));
+    sim::master_read_register(address, ALERT_STATUS_REG, data, 1);
+    transactions = 0;
+    received = 0;
+    errors = 0;
+    while(received < SAMPLE_COUNT){
+        sim::advance_us(100);
+        sim::run_bus_nodes();
+        if(sim::get_pin(I2C_FRAMEWORK_ALERT) != 0){
+            continue;
+        }
+
+        sim::master_read_register(address, ALERT_STATUS_REG, data, 1);
+        transactions++;
+        if(data[0] & ALERT_FIFO_WATERMARK){
+            sim::master_read_register(address, FIFO_DRAIN_REG, data, sizeof(data));
+            transactions++;
+            check_drain();
+        }
+    }
+    printf("alert: %d samples in %d transactions, %.2f per sample, %d errors\n", received, transactions, (double) transactions / received, errors);
+    sim::check(errors == 0 && transactions < received, "drained on ALERT# in order, fewer transactions than samples");
+
+    sim::master_read_register(address, FIFO_LEVEL_REG, data, I2C_FIFO_LEVEL_SIZE);
+    printf("fifo level: %d, flags: 0x%02x, record size: %d\n", (uint8_t) data[0] | (uint8_t) data[1] << 8, data[2], data[3]);
+    sim::check((data[2] & FIFO_FLAG_OVERFLOW) == 0 && data[3] == I2C_FIFO_TIMESTAMP_SIZE + 4, "no overflow, timestamped records");
+
+    return sim::test_result();
+}
@@ -0,0 +1,198 @@
+/*
+ * Staged firmware update: the master writes a new image through FIRMWARE_STAGE_REG while the firmware keeps running.
+ * The node loses power after a few pages and resumes with the pages it already staged, an image corrupted on the
+ * bus fails verification and is sent again, then the verified image is handed to the bootloader.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include "mbedtls/sha256.h"
+
+#define APPLICATION_SIZE (10000)
+#define IMAGE_SIZE (APPLICATION_ADDRESS - APPLICATION_HEADER_ADDRESS + APPLICATION_SIZE)
+#define PAGE_COUNT ((IMAGE_SIZE + FIRMWARE_STAGE_PAGE_SIZE - 1) / FIRMWARE_STAGE_PAGE_SIZE)
+
+static char image[IMAGE_SIZE];
+static unsigned char image_hash[32];
+static int address = 0x20;
+static int transactions = 0;
+
+// Header of mbed_app.json header_format, then the application
+static void build_image()
+{
+    uint32_t application_offset = APPLICATION_ADDRESS - APPLICATION_HEADER_ADDRESS;
+    memset(image, 0xFF, application_offset);
+    for(int i = 0; i < APPLICATION_SIZE; i++){
+        image[application_offset + i] = i * 31 + (i >> 8);
+    }
+
+    MbedCRC<POLY_32BIT_ANSI, 32> crc;
+    uint32_t crc_value;
+    crc.compute(&image[application_offset], APPLICATION_SIZE, &crc_value);
+    mbedtls_sha256_ret((const unsigned char *) &image[application_offset], APPLICATION_SIZE, image_hash, 0);
+
+    uint32_t magic = FIRMWARE_STAGE_HEADER_MAGIC;
+    uint64_t firmware_size = APPLICATION_SIZE;
+    memcpy(&image[0], &magic, 4);
+    memcpy(&image[4], &firmware_size, 8);
+    memcpy(&image[12], &crc_value, 4);
+    memcpy(&image[16], image_hash, 32);
+}
+
+// Poll the status until the node is done with the last command
+static void read_status(char *status)
+{
+    do {
+        sim::master_read_register(address, FIRMWARE_STAGE_REG, status, FIRMWARE_STAGE_STATUS_SIZE);
+        transactions++;
+    } while(status[0] == FIRMWARE_STAGE_BUSY);
+}
+
+static uint32_t get_bitmap(const char *status)
+{
+    return (uint8_t) status[2] | (uint8_t) status[3] << 8 | (uint8_t) status[4] << 16 | (uint32_t) (uint8_t) status[5] << 24;
+}
+
+static void write_command(const char *command, int size)
+{
+    char frame[1 + FIRMWARE_STAGE_COMMAND_MAX_SIZE];
+    frame[0] = FIRMWARE_STAGE_REG;
+    memcpy(&frame[1], command, size);
+    sim::master_write(address, frame, 1 + size);
+    transactions++;
+}
+
+static void start()
+{
+    char command[FIRMWARE_STAGE_START_SIZE];
+    uint32_t size = IMAGE_SIZE;
+    command[0] = FIRMWARE_STAGE_START_CMD;
+    memcpy(&command[1], &size, 4);
+    memcpy(&command[5], image_hash, 32);
+    write_command(command, sizeof(command));
+}
+
+// Send the pages missing from the bitmap, corrupt_offset flips a byte on the bus (-1 for none)
+static int send_missing_pages(uint32_t bitmap, int corrupt_offset)
+{
+    int sent = 0;
+    char status[FIRMWARE_STAGE_STATUS_SIZE];
+    for(int page = 0; page < PAGE_COUNT; page++){
+        if(bitmap & (1UL << page)){
+            continue;
+        }
+        int page_start = page * FIRMWARE_STAGE_PAGE_SIZE;
+        int page_end = page_start + FIRMWARE_STAGE_PAGE_SIZE < IMAGE_SIZE ? page_start + FIRMWARE_STAGE_PAGE_SIZE : IMAGE_SIZE;
+        for(int offset = page_start; offset < page_end; offset += FIRMWARE_STAGE_CHUNK_SIZE){
+            int length = page_end - offset < FIRMWARE_STAGE_CHUNK_SIZE ? page_end - offset : FIRMWARE_STAGE_CHUNK_SIZE;
+            char command[FIRMWARE_STAGE_COMMAND_MAX_SIZE];
+            command[0] = FIRMWARE_STAGE_DATA_CMD;
+            memcpy(&command[1], &offset, 4);
+            command[5] = length;
+            memcpy(&command[FIRMWARE_STAGE_DATA_HEADER_SIZE], &image[offset], length);
+            if(corrupt_offset >= offset && corrupt_offset < offset + length){
+                command[FIRMWARE_STAGE_DATA_HEADER_SIZE + corrupt_offset - offset] ^= 0x10;
+            }
+            write_command(command, FIRMWARE_STAGE_DATA_HEADER_SIZE + length);
+        }
+        read_status(status);
+        sent++;
+    }
+    return sent;
+}
+
+static void verify(char *status)
+{
+    const char command = FIRMWARE_STAGE_VERIFY_CMD;
+    write_command(&command, 1);
+    read_status(status);
+}
+
+int main()
+{
+#if !I2C_FRAMEWORK_FIRMWARE_STAGING
+    printf("firmware_staging option disabled\n");
+    return SIM_TEST_SKIPPED;
+#endif
+
+    sim::set_uid(0xCAFE0046);
+    sim::set_bus_frequency(1000000);
+    build_image();
+
+    char status[FIRMWARE_STAGE_STATUS_SIZE];
+    char data[8];
+    {
+        I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+        node.init();
+        sim::add_bus_node([&node]() {
+            node.loop_iteration();
+        });
+
+        sim::assign_address(0xCAFE0046, address);
+        node.flush_metadata();
+
+        // Power lost after three pages
+        start();
+        read_status(status);
+        send_missing_pages(~(uint32_t) 0x7, -1);
+        read_status(status);
+        printf("before power loss: state %d, %d pages, staged 0x%02x\n", status[0], status[1], get_bitmap(status));
+        sim::check(get_bitmap(status) == 0x7, "three pages staged before the power loss");
+        sim::clear_bus_nodes();
+    }
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    // Same image, only the missing pages are sent, one byte is corrupted on the bus
+    uint32_t start_time = sim::now_us();
+    transactions = 0;
+    start();
+    read_status(status);
+    printf("after reset: state %d, staged 0x%02x\n", status[0], get_bitmap(status));
+    sim::check(get_bitmap(status) == 0x7, "staged pages kept across the reset");
+    int sent = send_missing_pages(get_bitmap(status), IMAGE_SIZE - 100);
+    verify(status);
+    printf("resumed: %d pages sent, verify state %d (error %d)\n", sent, status[0], FIRMWARE_STAGE_ERROR);
+    sim::check(sent == 3 && status[0] == FIRMWARE_STAGE_ERROR, "only missing pages sent, corrupted image rejected");
+
+    // Verification failed, the whole image is sent again
+    start();
+    read_status(status);
+    sent = send_missing_pages(get_bitmap(status), -1);
+    verify(status);
+    printf("sent again: %d pages, verify state %d (verified %d), %d transactions, %u us\n", sent, status[0], FIRMWARE_STAGE_VERIFIED, transactions, sim::now_us() - start_time);
+    sim::check(status[0] == FIRMWARE_STAGE_VERIFIED, "image verified once sent again");
+
+    // Install resets into the bootloader with the staged flag
+    const char install = FIRMWARE_STAGE_INSTALL_CMD;
+    try {
+        write_command(&install, 1);
+        sim::run_bus_nodes();
+        printf("no reset after install\n");
+        sim::check(false, "install resets the MCU");
+    } catch(sim::SystemReset &) {
+        uint32_t magic;
+        memcpy(&magic, sim::flash_memory() + (APPLICATION_METADATA_ADDRESS - SIM_FLASH_ADDRESS), 4);
+        printf("reset, bootloader flag staged: %d\n", magic == MAGIC_FIRMWARE_STAGED);
+        sim::check(magic == MAGIC_FIRMWARE_STAGED, "bootloader flag set to staged before the reset");
+    }
+
+    // No bootloader installs staged images here, the old firmware boots with the flag still set
+    sim::clear_bus_nodes();
+    I2C_Framework rebooted(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    rebooted.init();
+    sim::add_bus_node([&rebooted]() {
+        rebooted.loop_iteration();
+    });
+    uint32_t magic;
+    memcpy(&magic, sim::flash_memory() + (APPLICATION_METADATA_ADDRESS - SIM_FLASH_ADDRESS), 4);
+    sim::master_read_register(address, ALERT_STATUS_REG, data, 1);
+    printf("not installed: flag cleared %d, alert error %d\n", magic != MAGIC_FIRMWARE_STAGED, (data[0] & ALERT_ERROR) != 0);
+    sim::check(magic != MAGIC_FIRMWARE_STAGED && (data[0] & ALERT_ERROR) != 0, "image not installed: flag cleared and error raised");
+
+    return sim::test_result();
+}
@@ -0,0 +1,99 @@
+/*
+ * Interrupt mode: the node gets the address, each byte and the stop of a transaction from its I2C interrupt.
+ * A register selected by a write is read after a repeated start, a writable bank stores the bytes written
+ * and its pointer moves by the bytes the master read before its stop. A write filling its buffer keeps its PEC
+ * aside, a longer one is dropped with PEC and cut to the buffer without.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+#define BANK_FIRST_REG (0x40)
+#define BANK_SIZE (8)
+#define BUFFERED_REG (0x10)
+
+static char bank[BANK_SIZE];
+static char buffered[4];
+static char accepted[4];
+static int accepted_writes = 0;
+
+static int write_buffered(char *data)
+{
+    // Data received in the buffer of the register, only for writes kept
+    memcpy(accepted, data, sizeof(accepted));
+    accepted_writes++;
+    return BUFFERED_REG;
+}
+
+static void print_bytes(const char *name, const char *data, int size)
+{
+    printf("%s:", name);
+    for(int i = 0; i < size; i++){
+        printf(" %02x", (uint8_t) data[i]);
+    }
+    printf("\n");
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0002);
+    for(int i = 0; i < BANK_SIZE; i++){
+        bank[i] = 0xB0 + i;
+    }
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    int rc = node.add_i2c_register_bank(BANK_FIRST_REG, bank, BANK_SIZE, true);
+    sim::check(rc == 0, "writable bank accepted in interrupt mode");
+    node.add_i2c_callback(BUFFERED_REG, nullptr, &write_buffered, sizeof(buffered));
+    node.set_i2c_write_buffer(BUFFERED_REG, buffered, sizeof(buffered));
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    // Address resolution is polled, the interrupt serves the node once it has an address
+    int address = 0x22;
+    char data[BANK_SIZE];
+    sim::assign_address(0xCAFE0002, address);
+    node.flush_metadata();
+
+    // Register written then read after a repeated start, the write ends at the address of the read
+    rc = sim::master_read_register(address, UID_REG, data, 4);
+    print_bytes("UID_REG after a repeated start", data, 4);
+    sim::check(rc == 0 && memcmp(data, "\x02\x00\xfe\xca", 4) == 0, "register selected before the repeated start read");
+
+    // Bank written from 0x42, the pointer moves past the bytes written
+    const char bank_write[] = {BANK_FIRST_REG + 2, 0x11, 0x22, 0x33};
+    sim::master_write(address, bank_write, sizeof(bank_write));
+    print_bytes("bank after a write at 0x42", bank, BANK_SIZE);
+    sim::check(memcmp(&bank[2], &bank_write[1], 3) == 0 && bank[1] == (char) 0xB1 && bank[5] == (char) 0xB5, "bank bytes written");
+    sim::master_read(address, data, 2);
+    print_bytes("read from the pointer", data, 2);
+    sim::check(memcmp(data, &bank[5], 2) == 0, "pointer past the bytes written");
+
+    // Master stops after 3 of the bytes from 0x40, counted at the stop
+    // With PEC the master reads one byte more, taken as its PEC, which is one of the bank for a partial read
+    sim::master_read_register(address, BANK_FIRST_REG, data, 3);
+    sim::master_read(address, data, 2);
+    print_bytes("read after 3 bytes from 0x40", data, 2);
+    sim::check(memcmp(data, &bank[3 + SIM_PEC], 2) == 0, "pointer moved by the bytes read before the stop");
+
+    // Write filling the buffer of its register
+    const char buffered_write[] = {BUFFERED_REG, 1, 2, 3, 4};
+    sim::master_write(address, buffered_write, sizeof(buffered_write));
+    print_bytes("write of 4 bytes", accepted, sizeof(accepted));
+    sim::check(accepted_writes == 1 && memcmp(accepted, &buffered_write[1], sizeof(accepted)) == 0, "write filling its buffer accepted");
+
+    // One byte more than the buffer
+    const char long_write[] = {BUFFERED_REG, 5, 6, 7, 8, 9};
+    sim::master_write(address, long_write, sizeof(long_write));
+    printf("write of 5 bytes accepted: %d\n", accepted_writes == 2);
+#if SIM_PEC
+    // The PEC and the extra byte do not fit, the PEC is unknown
+    sim::check(accepted_writes == 1, "write longer than its buffer dropped");
+#else
+    sim::check(accepted_writes == 2 && memcmp(accepted, &long_write[1], sizeof(accepted)) == 0, "bytes past the buffer dropped");
+#endif
+
+    return sim::test_result();
+}
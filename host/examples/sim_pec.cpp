@@ -0,0 +1,84 @@
+/*
+ * SMBus Packet Error Checking: the master checks the PEC of reads and appends one to writes,
+ * a write corrupted on the bus is dropped by the node before it changes anything.
+ * A stream frame of a whole chunk is received with its PEC, polled writes take it after the largest frame.
+ * Build with -DI2C_FRAMEWORK_PEC=ON.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+static char rx_storage[512];
+
+int main()
+{
+#if !I2C_FRAMEWORK_PEC
+    printf("PEC disabled, build with -DI2C_FRAMEWORK_PEC=ON\n");
+    return SIM_TEST_SKIPPED;
+#endif
+
+    sim::set_uid(0xCAFE0045);
+
+    RingBuffer rx_stream(rx_storage, sizeof(rx_storage));
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node.set_stream_buffers(nullptr, &rx_stream);
+    node.init();
+
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    // Address resolution with PEC
+    int address = 0x20;
+    char data[32];
+    uint32_t uid = 0;
+    bool ok = sim::read_arp_uid(&uid) == 0;
+    printf("UID PEC ok: %d\n", ok);
+    sim::check(ok && uid == 0xCAFE0045, "PEC of the UID sent during address resolution");
+    sim::assign_address(0xCAFE0045, address);
+    bool answered = sim::master_read(address, data, 1) == 0;
+    printf("slaves on 0x%02x: %d\n", address, answered);
+    sim::check(answered, "node answers on the assigned address");
+
+    const char group_write[] = {(char) GROUP_REG, 7};
+    sim::master_write(address, group_write, sizeof(group_write));
+    ok = sim::master_read_register(address, GROUP_REG, data, 1) == 0;
+    printf("group after valid write: %d, PEC ok: %d\n", data[0], ok);
+    sim::check(ok && data[0] == 7, "write with a valid PEC applied");
+
+    const char corrupted_write[] = {(char) GROUP_REG, 9};
+    sim::corrupt_write();
+    sim::master_write(address, corrupted_write, sizeof(corrupted_write));
+    ok = sim::master_read_register(address, GROUP_REG, data, 1) == 0;
+    printf("group after corrupted write: %d, PEC ok: %d\n", data[0], ok);
+    sim::check(ok && data[0] == 7, "write with a corrupted PEC dropped");
+
+    ok = sim::master_read_register(address, UID_REG, data, 4) == 0;
+    printf("UID_REG: %02x %02x %02x %02x, PEC ok: %d\n", (uint8_t) data[0], (uint8_t) data[1], (uint8_t) data[2], (uint8_t) data[3], ok);
+    sim::check(ok && memcmp(data, "\x45\x00\xfe\xca", 4) == 0, "UID_REG read with a valid PEC");
+
+    // Stream frames of half and of a whole chunk, the PEC follows the largest write of the node
+    char frame[1 + I2C_STREAM_FRAME_SIZE];
+    int received = 0;
+    for(int length = I2C_STREAM_CHUNK_SIZE / 2; length <= I2C_STREAM_CHUNK_SIZE; length += I2C_STREAM_CHUNK_SIZE / 2){
+        char status[I2C_STREAM_STATUS_SIZE];
+        sim::master_read_register(address, STREAM_STATUS_REG, status, sizeof(status));
+        frame[0] = STREAM_REG;
+        frame[1] = length;
+        frame[2] = length >> 8;
+        frame[3] = status[6];
+        frame[4] = status[7];
+        for(int i = 0; i < length; i++){
+            frame[1 + I2C_STREAM_HEADER_SIZE + i] = i;
+        }
+        sim::master_write(address, frame, 1 + I2C_STREAM_HEADER_SIZE + length);
+
+        int available = rx_stream.available();
+        received += rx_stream.read(&frame[1 + I2C_STREAM_HEADER_SIZE], sizeof(frame));
+        printf("stream frame of %d bytes: %d received\n", length, available);
+        sim::check(available == length, "stream frame received with its PEC");
+    }
+    sim::check(received == I2C_STREAM_CHUNK_SIZE / 2 + I2C_STREAM_CHUNK_SIZE, "half and whole chunk frames received");
+
+    return sim::test_result();
+}
@@ -0,0 +1,133 @@
+/*
+ * Read prefetch: the read callback of a register runs when the master selects it, the read then only copies data.
+ * Callbacks are prefetched once enabled, a register whose read clears a status is left non-prefetchable.
+ * A selection older than I2C_PREFETCH_MAX_AGE_US is resolved again at read time.
+ * Selection and read in one transaction with a repeated start run the callback once, a write of data resolves it again.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+#define MEASURE_REG (0x10)
+#define STATUS_REG (0x11)
+#define CONVERSION_TIME_US (300)
+
+static const char *phase = "";
+static char measure[2] = {0x12, 0x34};
+static char status[1] = {0};
+static int events = 0;
+static int selection_calls = 0;
+static int read_calls = 0;
+static char read_data[4];
+
+static void print_call(const char *name)
+{
+    printf("  %s callback during the %s\n", name, phase);
+    if(strcmp(phase, "read") == 0){
+        read_calls++;
+    } else {
+        selection_calls++;
+    }
+}
+
+static char *read_measure()
+{
+    // Conversion takes time, done before the read when prefetched
+    sim::advance_us(CONVERSION_TIME_US);
+    print_call("measure");
+    return measure;
+}
+
+static char *read_status()
+{
+    // Clears the events counted since the last read
+    status[0] = events;
+    events = 0;
+    print_call("status");
+    return status;
+}
+
+static int write_measure(char *buffer)
+{
+    // Register alone, keep the measure
+    if(buffer[1] == 0){
+        return MEASURE_REG;
+    }
+
+    // Calibration written, changes the measure read
+    measure[0] = buffer[1];
+    measure[1] = buffer[2];
+    return MEASURE_REG;
+}
+
+static void select_then_read(int address, uint8_t reg, int length, uint32_t delay_us)
+{
+    char select = reg;
+    selection_calls = 0;
+    read_calls = 0;
+    phase = "register selection";
+    sim::master_write(address, &select, 1);
+    sim::advance_us(delay_us);
+    phase = "read";
+    sim::master_read(address, read_data, length);
+}
+
+static int read_register(int address, uint8_t reg, int length)
+{
+    selection_calls = 0;
+    read_calls = 0;
+    phase = "register selection and read";
+    sim::master_read_register(address, reg, read_data, length);
+    return selection_calls + read_calls;
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0025);
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node.add_i2c_callback(MEASURE_REG, &read_measure, &write_measure, sizeof(measure));
+    node.add_i2c_callback(STATUS_REG, &read_status, nullptr, sizeof(status));
+    node.set_i2c_prefetch(MEASURE_REG, true);
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    int address = 0x25;
+    sim::assign_address(0xCAFE0025, address);
+    node.flush_metadata();
+
+    printf("prefetchable register read right after its selection:\n");
+    select_then_read(address, MEASURE_REG, sizeof(measure), 0);
+    sim::check(selection_calls == 1 && read_calls == 0 && memcmp(read_data, measure, sizeof(measure)) == 0, "prefetched on selection");
+
+    printf("non-prefetchable register:\n");
+    events = 3;
+    select_then_read(address, STATUS_REG, sizeof(status), 0);
+    sim::check(selection_calls == 0 && read_calls == 1 && read_data[0] == 3, "non-prefetchable register resolved at read time");
+
+    printf("prefetchable register read %d us after its selection:\n", 2 * I2C_PREFETCH_MAX_AGE_US);
+    select_then_read(address, MEASURE_REG, sizeof(measure), 2 * I2C_PREFETCH_MAX_AGE_US);
+    sim::check(read_calls == 1 && memcmp(read_data, measure, sizeof(measure)) == 0, "stale prefetch resolved again at read time");
+
+    printf("prefetchable register selected and read with a repeated start:\n");
+    int calls = read_register(address, MEASURE_REG, sizeof(measure));
+    sim::check(calls == 1 && memcmp(read_data, measure, sizeof(measure)) == 0, "callback run once for selection and read");
+
+    printf("non-prefetchable register selected and read with a repeated start:\n");
+    events = 5;
+    calls = read_register(address, STATUS_REG, sizeof(status));
+    sim::check(calls == 1 && read_data[0] == 5, "status cleared once");
+
+    printf("prefetchable register read after a write of data:\n");
+    const char calibration[] = {MEASURE_REG, 0x56, 0x78};
+    selection_calls = 0;
+    read_calls = 0;
+    phase = "write";
+    sim::master_write(address, calibration, sizeof(calibration));
+    phase = "read";
+    sim::master_read(address, read_data, sizeof(measure));
+    sim::check(read_calls == 0 && memcmp(read_data, &calibration[1], sizeof(measure)) == 0, "read data resolved again after the data written");
+
+    return sim::test_result();
+}
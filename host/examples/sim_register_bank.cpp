@@ -0,0 +1,86 @@
+/*
+ * Register bank: a measurement block in RAM mapped onto registers 0x40 to 0x4F, served without callbacks.
+ * The master reads many registers in one transaction, then continues from the register pointer.
+ * Writable banks need interrupt mode, the host build polls so the bank is read-only here.
+ * A bank takes a single register slot whatever its size.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+#define BANK_FIRST_REG (0x40)
+#define BANK_SIZE (16)
+
+static char bank[BANK_SIZE];
+
+static void print_bytes(const char *name, const char *data, int size)
+{
+    printf("%s:", name);
+    for(int i = 0; i < size; i++){
+        printf(" %02x", (uint8_t) data[i]);
+    }
+    printf("\n");
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0024);
+    for(int i = 0; i < BANK_SIZE; i++){
+        bank[i] = 0xB0 + i;
+    }
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    int rc = node.add_i2c_register_bank(BANK_FIRST_REG, bank, BANK_SIZE, true);
+    printf("writable bank when polling: %d\n", rc);
+    sim::check(rc == -1, "writable bank rejected when polling");
+    node.add_i2c_register_bank(BANK_FIRST_REG, bank, BANK_SIZE);
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    int address = 0x24;
+    char data[BANK_SIZE];
+    sim::assign_address(0xCAFE0024, address);
+    node.flush_metadata();
+
+    // Whole bank in one read
+    uint32_t start = sim::now_us();
+    sim::master_read_register(address, BANK_FIRST_REG, data, BANK_SIZE);
+    printf("read of %d registers in one transaction: %u us\n", BANK_SIZE, sim::now_us() - start);
+    print_bytes("bank", data, BANK_SIZE);
+    sim::check(memcmp(data, bank, BANK_SIZE) == 0, "whole bank in one read");
+
+    // Application updates the bank, the master selects 0x48 with the register byte alone and reads to the end
+    for(int i = 0; i < BANK_SIZE; i++){
+        bank[i] = 0xC0 + i;
+    }
+    char select = BANK_FIRST_REG + 8;
+    sim::master_write(address, &select, 1);
+    sim::master_read(address, data, 8);
+    print_bytes("read from 0x48", data, 8);
+    sim::check(memcmp(data, &bank[8], 8) == 0, "read from the selected register to the end of the bank");
+
+    // Pointer moved past the read and wrapped to the first register, a read without register byte continues there
+    sim::master_read(address, data, 4);
+    print_bytes("read from the pointer", data, 4);
+    sim::check(memcmp(data, bank, 4) == 0, "read continues at the wrapped pointer");
+
+    // Bank and callbacks on other registers use every user slot, then no bank is added
+    I2C_Framework full_node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    rc = full_node.add_i2c_register_bank(BANK_FIRST_REG, bank, BANK_SIZE);
+    int callbacks = 0;
+    for(int reg = 0; reg < I2C_REGISTER_COUNT && callbacks < I2C_USER_REGISTER_SLOTS - 1; reg++){
+        bool in_bank = reg >= BANK_FIRST_REG && reg < BANK_FIRST_REG + BANK_SIZE;
+        bool builtin = reg >= FIRMWARE_REG && reg <= BUS_HEALTH_REG;
+        if(!in_bank && !builtin){
+            full_node.add_i2c_callback(reg, nullptr, nullptr, 1);
+            callbacks++;
+        }
+    }
+    int full_rc = full_node.add_i2c_register_bank(0, bank, BANK_SIZE);
+    printf("bank with %d register slots: %d, once all used: %d\n", I2C_USER_REGISTER_SLOTS, rc, full_rc);
+    sim::check(rc == 0 && full_rc == -1, "bank rejected once every register slot is used");
+
+    return sim::test_result();
+}
@@ -0,0 +1,84 @@
+/*
+ * Task scheduler: sampling every 10 ms, a filter released by every fourth sample with a 5 ms deadline and a slow
+ * housekeeping task every 100 ms share the main loop with the I2C service. Task durations are simulated by
+ * advancing the clock, the output is the execution time accounting of each task over one second.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include "task_scheduler.h"
+
+#define RUN_TIME_US (1000000)
+#define SAMPLE_PERIOD_US (10000)
+#define SAMPLE_TIME_US (200)
+#define FILTER_DEADLINE_US (5000)
+#define FILTER_TIME_US (1500)
+#define HOUSEKEEPING_PERIOD_US (100000)
+#define HOUSEKEEPING_TIME_US (4000)
+
+static TaskScheduler *scheduler;
+static int filter_task;
+static int sample_count = 0;
+
+static void sample(void *context)
+{
+    sim::advance_us(SAMPLE_TIME_US);
+    if(++sample_count % 4 == 0){
+        scheduler->schedule(filter_task, FILTER_DEADLINE_US);
+    }
+}
+
+static void filter(void *context)
+{
+    sim::advance_us(FILTER_TIME_US);
+}
+
+static void housekeeping(void *context)
+{
+    sim::advance_us(HOUSEKEEPING_TIME_US);
+}
+
+static void print_stats(const char *name, int id)
+{
+    TaskScheduler::task_stats_t stats;
+    scheduler->get_task_stats(id, &stats);
+    printf("%-12s runs %3u, average %5u us, max %5u us, missed deadlines %u\n", name, stats.run_count, stats.run_count > 0 ? stats.total_time_us / stats.run_count : 0, stats.max_time_us, stats.missed_deadlines);
+    sim::check(stats.run_count > 0 && stats.missed_deadlines == 0, "task runs without missing its deadline");
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0022);
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node.init();
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    // Address assigned before the tasks start
+    sim::assign_address(0xCAFE0022, 0x22);
+    node.flush_metadata();
+    sim::clear_bus_nodes();
+
+    scheduler = new TaskScheduler(node);
+    int sample_task = scheduler->add_periodic_task(&sample, nullptr, SAMPLE_PERIOD_US);
+    filter_task = scheduler->add_deadline_task(&filter, nullptr);
+    int housekeeping_task = scheduler->add_periodic_task(&housekeeping, nullptr, HOUSEKEEPING_PERIOD_US);
+
+    // Main loop, the host has no Stop mode so the wait is simulated
+    uint32_t start = sim::now_us();
+    int services = 0;
+    while(sim::now_us() - start < RUN_TIME_US){
+        uint32_t wait_us = scheduler->run_once();
+        services++;
+        if(wait_us > 0){
+            sim::advance_us(wait_us);
+        }
+    }
+
+    printf("%d I2C services in %u us\n", services, sim::now_us() - start);
+    print_stats("sample", sample_task);
+    print_stats("filter", filter_task);
+    print_stats("housekeeping", housekeeping_task);
+    return sim::test_result();
+}
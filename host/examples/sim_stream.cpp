@@ -0,0 +1,133 @@
+/*
+ * Streaming through STREAM_REG: the node pushes a waveform capture that the master reads as back-to-back frames,
+ * again after switching the bus to Fast-mode Plus, then the master writes a calibration table with flow control
+ * from STREAM_STATUS_REG.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+#define CAPTURE_SIZE (4096)
+#define CALIBRATION_SIZE (2048)
+
+static char tx_storage[1024];
+static char rx_storage[1024];
+
+static uint16_t get_uint16(const char *data)
+{
+    return (uint8_t) data[0] | (uint8_t) data[1] << 8;
+}
+
+int main()
+{
+    sim::set_uid(0xCAFE0043);
+
+    RingBuffer tx_stream(tx_storage, sizeof(tx_storage));
+    RingBuffer rx_stream(rx_storage, sizeof(rx_storage));
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node.set_stream_buffers(&tx_stream, &rx_stream);
+    node.init();
+
+    // Application side: fill the capture as room is available, consume the calibration table
+    int captured = 0;
+    int calibration_received = 0;
+    sim::add_bus_node([&]() {
+        node.loop_iteration();
+
+        while(captured < CAPTURE_SIZE && tx_stream.space() > 0){
+            char sample = captured;
+            captured += tx_stream.write(&sample, 1);
+        }
+
+        char data[64];
+        calibration_received += rx_stream.read(data, sizeof(data));
+    });
+
+    // Assign an address to the node through address resolution
+    int address = 0x20;
+    char data[I2C_STREAM_FRAME_SIZE];
+    sim::assign_address(0xCAFE0043, address);
+
+    // Select the stream once, then read frames back to back
+    uint16_t expected_sequence = 0;
+    auto read_capture = [&](const char *label) {
+        uint32_t start = sim::now_us();
+        int received = 0;
+        int transactions = 0;
+        int errors = 0;
+        char reg = STREAM_REG;
+        sim::master_write(address, &reg, 1);
+        while(received < CAPTURE_SIZE){
+            sim::master_read(address, data, I2C_STREAM_FRAME_SIZE);
+            transactions++;
+
+            uint16_t length = get_uint16(&data[0]);
+            uint16_t sequence = get_uint16(&data[2]);
+            if(length == 0){
+                continue;
+            }
+            if(sequence != expected_sequence){
+                errors++;
+            }
+            for(int i = 0; i < length; i++){
+                if((char) (received + i) != data[I2C_STREAM_HEADER_SIZE + i]){
+                    errors++;
+                }
+            }
+            received += length;
+            expected_sequence++;
+        }
+        printf("%s: %d bytes in %d transactions, %u us, %d errors\n", label, received, transactions, sim::now_us() - start, errors);
+        sim::check(errors == 0, "capture frames in sequence with the expected data");
+    };
+    read_capture("capture at 100 kHz");
+
+    // Switch the whole bus to the fastest mode all nodes support
+    char bus_speed[BUS_SPEED_SIZE];
+    sim::master_read_register(address, BUS_SPEED_REG, bus_speed, sizeof(bus_speed));
+    const char bus_mode[] = {GENERAL_CALL_BUS_MODE_CMD, bus_speed[0]};
+    sim::master_write(0, bus_mode, sizeof(bus_mode));
+    sim::set_bus_frequency(1000000);
+    sim::run_bus_nodes();
+    sim::master_read_register(address, BUS_SPEED_REG, bus_speed, sizeof(bus_speed));
+    printf("bus mode: %d of %d, FM+ drive: %d\n", bus_speed[1], bus_speed[0], bus_speed[2]);
+    sim::check(bus_speed[1] == bus_speed[0], "node switched to its fastest bus mode");
+
+    captured = 0;
+    read_capture("capture at 1 MHz");
+
+    // Write the calibration table, waiting for room in the node
+    uint32_t start = sim::now_us();
+    int transactions = 0;
+    int sent = 0;
+    char frame[1 + I2C_STREAM_FRAME_SIZE];
+    while(sent < CALIBRATION_SIZE){
+        char status[I2C_STREAM_STATUS_SIZE];
+        sim::master_read_register(address, STREAM_STATUS_REG, status, sizeof(status));
+        transactions++;
+        uint16_t space = get_uint16(&status[2]);
+        uint16_t sequence = get_uint16(&status[6]);
+        if(space < I2C_STREAM_CHUNK_SIZE){
+            continue;
+        }
+
+        int length = CALIBRATION_SIZE - sent < I2C_STREAM_CHUNK_SIZE ? CALIBRATION_SIZE - sent : I2C_STREAM_CHUNK_SIZE;
+        frame[0] = STREAM_REG;
+        frame[1] = length;
+        frame[2] = length >> 8;
+        frame[3] = sequence;
+        frame[4] = sequence >> 8;
+        for(int i = 0; i < length; i++){
+            frame[1 + I2C_STREAM_HEADER_SIZE + i] = sent + i;
+        }
+        sim::master_write(address, frame, 1 + I2C_STREAM_HEADER_SIZE + length);
+        transactions++;
+        sent += length;
+    }
+    sim::run_bus_nodes();
+    printf("calibration: %d bytes in %d transactions, %u us, %d received\n", sent, transactions, sim::now_us() - start, calibration_received);
+    sim::check(calibration_received == CALIBRATION_SIZE, "whole calibration table received");
+
+    return sim::test_result();
+}
@@ -0,0 +1,145 @@
+/*
+ * Synchronised sampling: nodes sampled one after the other by the master get timestamps spread by the polling time,
+ * nodes sampling on a sync latch general call get the same timestamp. A time sync general call then aligns the
+ * node timestamps on the master clock.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+#include <memory>
+
+#define NODE_COUNT (4)
+#define FIRST_ADDRESS (0x10)
+#define SAMPLE_REG (0x10)
+#define RECORD_SIZE (I2C_FIFO_TIMESTAMP_SIZE + 4)
+
+// Master clock, with its own epoch
+#define MASTER_EPOCH (1000000000)
+
+static uint32_t master_time()
+{
+    return sim::now_us() + MASTER_EPOCH;
+}
+
+class Sensor
+{
+public:
+    Sensor() : node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL), fifo(fifo_storage, sizeof(fifo_storage)), value(0)
+    {
+    }
+
+    void sample()
+    {
+        value++;
+        node.push_sample(&value);
+    }
+
+    // Sampled when the master reads it
+    int read_sample(i2c_span_t data)
+    {
+        sample();
+        memcpy(data.data, &value, 4);
+        return 4;
+    }
+
+    static void sync_hook(void *context, uint32_t timestamp)
+    {
+        static_cast<Sensor *>(context)->sample();
+    }
+
+    I2C_Framework node;
+    char fifo_storage[256];
+    RingBuffer fifo;
+    uint32_t value;
+};
+
+static constexpr i2c_register_handler_t<Sensor> sensor_map[] = {
+    {SAMPLE_REG, &Sensor::read_sample, nullptr, 4},
+};
+
+static uint32_t get_uint32(const char *data)
+{
+    return (uint8_t) data[0] | (uint8_t) data[1] << 8 | (uint8_t) data[2] << 16 | (uint32_t) (uint8_t) data[3] << 24;
+}
+
+// Timestamps of the last sample of each node, return the spread between nodes
+static uint32_t drain_timestamps(uint32_t *timestamps)
+{
+    uint32_t first = 0;
+    uint32_t last = 0;
+    for(int i = 0; i < NODE_COUNT; i++){
+        char data[1 + RECORD_SIZE];
+        sim::master_read_register(FIRST_ADDRESS + i, FIFO_DRAIN_REG, data, sizeof(data));
+        timestamps[i] = get_uint32(&data[1]);
+        if(i == 0 || (int32_t) (timestamps[i] - first) < 0){
+            first = timestamps[i];
+        }
+        if(i == 0 || (int32_t) (timestamps[i] - last) > 0){
+            last = timestamps[i];
+        }
+    }
+    return last - first;
+}
+
+int main()
+{
+    std::vector<std::unique_ptr<Sensor>> sensors;
+    for(int i = 0; i < NODE_COUNT; i++){
+        sim::set_uid(0xCAFE0100 + i);
+        Sensor *sensor = new Sensor();
+        sensors.emplace_back(sensor);
+        sensor->node.set_sample_fifo(&sensor->fifo, 4);
+        sensor->node.add_i2c_register_map<decltype(sensor_map), sensor_map>(sensor);
+        sensor->node.add_sync_hook(&Sensor::sync_hook, sensor);
+        sensor->node.init();
+        sim::add_bus_node([sensor]() {
+            sensor->node.loop_iteration();
+        });
+    }
+
+    // Addresses in UID order, one record per drain
+    uint32_t uid;
+    for(int address = FIRST_ADDRESS; sim::read_arp_uid(&uid) == 0; address++){
+        sim::assign_address(uid, address);
+        const char drain_count[] = {(char) FIFO_DRAIN_REG, 1};
+        sim::master_write(address, drain_count, sizeof(drain_count));
+    }
+
+    // Each node sampled when the master reads it
+    uint32_t timestamps[NODE_COUNT];
+    for(int i = 0; i < NODE_COUNT; i++){
+        char data[4];
+        sim::master_read_register(FIRST_ADDRESS + i, SAMPLE_REG, data, sizeof(data));
+    }
+    printf("polled sampling: spread %u us\n", drain_timestamps(timestamps));
+
+    // All nodes sampled by one latch
+    const char latch = GENERAL_CALL_SYNC_LATCH_CMD;
+    sim::master_write(0, &latch, 1);
+    uint32_t latch_master_time = master_time();
+    uint32_t spread = drain_timestamps(timestamps);
+    printf("latched sampling: spread %u us\n", spread);
+    sim::check(spread == 0, "one latch samples every node at once");
+
+    // Master time of that latch aligns the node time bases
+    char time_sync[5] = {GENERAL_CALL_TIME_SYNC_CMD};
+    for(int i = 0; i < 4; i++){
+        time_sync[1 + i] = latch_master_time >> (8 * i);
+    }
+    sim::master_write(0, time_sync, sizeof(time_sync));
+
+    sim::advance_us(10000);
+    sim::master_write(0, &latch, 1);
+    latch_master_time = master_time();
+    spread = drain_timestamps(timestamps);
+    int32_t offset = timestamps[0] - latch_master_time;
+    printf("after time sync: spread %u us, offset to master clock %d us\n", spread, offset);
+    sim::check(spread == 0 && offset > -100 && offset < 100, "node time bases aligned on the master clock");
+
+    char status[SYNC_STATUS_SIZE];
+    sim::master_read_register(FIRST_ADDRESS, SYNC_REG, status, sizeof(status));
+    printf("node 0: last latch %u, latches %d, time syncs %d\n", get_uint32(status), (uint8_t) status[4], (uint8_t) status[6]);
+    sim::check(status[4] == 2 && status[6] == 1, "latches and time syncs counted");
+
+    return sim::test_result();
+}
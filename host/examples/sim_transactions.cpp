@@ -0,0 +1,129 @@
+/*
+ * Simulated node answering a few master transactions, then showing the metadata commit in flash.
+ */
+
+#include "sim.h"
+#include "i2c_framework.h"
+
+static char sensor_value[4] = {1, 2, 3, 4};
+
+static char *read_sensor()
+{
+    return sensor_value;
+}
+
+static int write_sensor(char *buffer)
+{
+    // Register alone, keep it for the next read
+    if(buffer[1] == 0){
+        return 0x10;
+    }
+    memcpy(sensor_value, &buffer[1], 4);
+    return 0;
+}
+
+// Registers served by a register map, handlers are members of the object
+class Counter
+{
+public:
+    int read_count(i2c_span_t data)
+    {
+        memcpy(data.data, &count, sizeof(count));
+        return sizeof(count);
+    }
+
+    int write_count(i2c_span_t data)
+    {
+        // Register alone, keep it for the next read
+        if(data.size < (int) sizeof(count) || (data.data[0] == 0 && data.data[1] == 0)){
+            return 0x11;
+        }
+        memcpy(&count, data.data, sizeof(count));
+        return 0;
+    }
+
+    int read_increment(i2c_span_t data)
+    {
+        count++;
+        return read_count(data);
+    }
+
+private:
+    uint16_t count = 0;
+};
+
+static constexpr i2c_register_handler_t<Counter> counter_map[] = {
+    {0x11, &Counter::read_count, &Counter::write_count, 2},
+    // Reading increments the counter, not prefetched when the register is selected
+    {0x12, &Counter::read_increment, nullptr, 2, false},
+};
+static_assert(i2c_register_map_is_valid(counter_map), "Register defined twice");
+
+// Value published by the application, read without calling application code
+struct position_t{
+    int32_t x;
+    int32_t y;
+};
+
+int main()
+{
+    Counter counter;
+    I2CSnapshot<position_t> position;
+
+    sim::set_uid(0xCAFE0042);
+
+    I2C_Framework node(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+    node.add_i2c_callback(0x10, read_sensor, write_sensor, 4);
+    node.add_i2c_register_map<decltype(counter_map), counter_map>(&counter);
+    node.add_i2c_snapshot(0x13, &position);
+    node.init();
+
+    sim::add_bus_node([&node]() {
+        node.loop_iteration();
+    });
+
+    // Assign an address to the node through address resolution
+    int address = 0x20;
+    char data[32];
+    sim::assign_address(0xCAFE0042, address);
+
+    sim::master_read_register(address, UID_REG, data, 4);
+    printf("UID_REG: %02x %02x %02x %02x\n", (uint8_t) data[0], (uint8_t) data[1], (uint8_t) data[2], (uint8_t) data[3]);
+    sim::check(memcmp(data, "\x42\x00\xfe\xca", 4) == 0, "UID_REG is the unique ID");
+
+    const char sensor_write[] = {0x10, 9, 8, 7, 6};
+    sim::master_write(address, sensor_write, sizeof(sensor_write));
+    sim::master_read_register(address, 0x10, data, 4);
+    printf("register 0x10: %d %d %d %d\n", data[0], data[1], data[2], data[3]);
+    sim::check(memcmp(data, &sensor_write[1], 4) == 0, "callback register reads back its write");
+
+    const char counter_write[] = {0x11, 40, 0};
+    sim::master_write(address, counter_write, sizeof(counter_write));
+    sim::master_read_register(address, 0x12, data, 2);
+    printf("register 0x12: %d\n", data[0] | data[1] << 8);
+    sim::check((data[0] | data[1] << 8) == 41, "register map write then read");
+
+    position.publish({-5, 12});
+    position_t read_position;
+    sim::master_read_register(address, 0x13, (char *) &read_position, sizeof(read_position));
+    printf("register 0x13: x %d y %d\n", read_position.x, read_position.y);
+    sim::check(read_position.x == -5 && read_position.y == 12, "snapshot read");
+
+    // Name is kept in RAM until the commit delay elapsed
+    char name_write[33] = {(char) NAME_REG};
+    strcpy(&name_write[1], "sim-node");
+    sim::master_write(address, name_write, sizeof(name_write));
+    sim::master_read_register(address, METADATA_STATUS_REG, data, 1);
+    printf("commit pending: %d\n", data[0]);
+    sim::check(data[0] == 1, "name kept in RAM until the commit delay");
+
+    sim::advance_us(METADATA_COMMIT_DELAY_MS * 1000);
+    sim::run_bus_nodes();
+
+    sim::master_read_register(address, METADATA_STATUS_REG, data, 1);
+    sim::flash_stats_t stats = sim::flash_stats();
+    printf("commit pending: %d, erases: %u, programs: %u\n", data[0], stats.erase_count, stats.program_count);
+    sim::check(data[0] == 0 && stats.program_count > 0, "name committed to flash after the commit delay");
+
+    return sim::test_result();
+}
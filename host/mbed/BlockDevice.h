@@ -0,0 +1,6 @@
+#ifndef MBED_BLOCKDEVICE_H
+#define MBED_BLOCKDEVICE_H
+
+// Not used by the framework, included for mbed compatibility
+
+#endif // MBED_BLOCKDEVICE_H
@@ -0,0 +1,26 @@
+#ifndef MBED_DIGITALIN_H
+#define MBED_DIGITALIN_H
+
+#include "PinNames.h"
+
+namespace sim {
+int get_pin(PinName pin);
+void set_pin(PinName pin, int level);
+void drive_pin(PinName pin, int level);
+}
+
+class DigitalIn {
+public:
+    DigitalIn(PinName pin) : _pin(pin) {}
+    DigitalIn(PinName pin, PinMode mode) : _pin(pin) {}
+
+    int read() { return sim::get_pin(_pin); }
+    void mode(PinMode pull) {}
+    int is_connected() { return _pin != NC; }
+    operator int() { return read(); }
+
+private:
+    PinName _pin;
+};
+
+#endif // MBED_DIGITALIN_H
@@ -0,0 +1,30 @@
+#ifndef MBED_DIGITALINOUT_H
+#define MBED_DIGITALINOUT_H
+
+#include "DigitalIn.h"
+
+class DigitalInOut {
+public:
+    DigitalInOut(PinName pin) : _pin(pin), _output(false) {}
+    DigitalInOut(PinName pin, PinDirection direction, PinMode mode, int value) : _pin(pin), _output(direction == PIN_OUTPUT)
+    {
+        if (_output) {
+            write(value);
+        }
+    }
+
+    void write(int value) { sim::drive_pin(_pin, value); }
+    int read() { return sim::get_pin(_pin); }
+    void output() { _output = true; }
+    void input() { _output = false; }
+    void mode(PinMode pull) {}
+    int is_connected() { return _pin != NC; }
+    DigitalInOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+
+private:
+    PinName _pin;
+    bool _output;
+};
+
+#endif // MBED_DIGITALINOUT_H
@@ -0,0 +1,21 @@
+#ifndef MBED_DIGITALOUT_H
+#define MBED_DIGITALOUT_H
+
+#include "DigitalIn.h"
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin) : _pin(pin) {}
+    DigitalOut(PinName pin, int value) : _pin(pin) { write(value); }
+
+    void write(int value) { sim::drive_pin(_pin, value); }
+    int read() { return sim::get_pin(_pin); }
+    int is_connected() { return _pin != NC; }
+    DigitalOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+
+private:
+    PinName _pin;
+};
+
+#endif // MBED_DIGITALOUT_H
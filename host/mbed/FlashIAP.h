@@ -0,0 +1,23 @@
+#ifndef MBED_FLASHIAP_H
+#define MBED_FLASHIAP_H
+
+#include <cstdint>
+
+/**
+ * Internal flash backed by the simulated flash image, mapped at the STM32G071 flash address
+ */
+class FlashIAP {
+public:
+    int init();
+    int deinit();
+    int read(void *buffer, uint32_t addr, uint32_t size);
+    int program(const void *buffer, uint32_t addr, uint32_t size);
+    int erase(uint32_t addr, uint32_t size);
+    uint32_t get_page_size() const;
+    uint32_t get_sector_size(uint32_t addr) const;
+    uint32_t get_flash_start() const;
+    uint32_t get_flash_size() const;
+    uint8_t get_erase_value() const;
+};
+
+#endif // MBED_FLASHIAP_H
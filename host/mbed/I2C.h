@@ -0,0 +1,29 @@
+#ifndef MBED_I2C_H
+#define MBED_I2C_H
+
+#include "PinNames.h"
+
+/**
+ * I2C master on the simulated bus
+ */
+class I2C {
+public:
+    I2C(PinName sda, PinName scl);
+
+    void frequency(int hz);
+
+    /**
+     * @param address: 8-bit I2C address
+     * @return 0 on success (ack), non-zero on failure (nack)
+     */
+    int read(int address, char *data, int length, bool repeated = false);
+    int write(int address, const char *data, int length, bool repeated = false);
+
+    void start();
+    void stop();
+
+private:
+    int _hz;
+};
+
+#endif // MBED_I2C_H
@@ -0,0 +1,66 @@
+#ifndef MBED_I2C_SLAVE_H
+#define MBED_I2C_SLAVE_H
+
+#include "PinNames.h"
+#include <cstdint>
+#include <functional>
+
+namespace sim {
+struct transaction_t;
+
+// Event of a slave served from its interrupt, as the peripheral reports it
+struct bus_event_t {
+    enum type_t {
+        ADDRESS,
+        RECEIVE,
+        TRANSMIT,
+        STOP,
+        ARBITRATION_LOST
+    };
+    type_t type;
+    bool transmit;          // ADDRESS: the master reads
+    bool general_call;      // ADDRESS: general call address
+    bool alert_response;    // ADDRESS: alert response address
+    uint8_t data;           // RECEIVE: byte received, TRANSMIT: byte sent, set by the interrupt
+};
+}
+
+/**
+ * I2C slave on the simulated bus, transactions are queued by the sim master
+ */
+class I2CSlave {
+public:
+    enum RxStatus {
+        NoData         = 0,
+        ReadAddressed  = 1,
+        WriteGeneral   = 2,
+        WriteAddressed = 3
+    };
+
+    I2CSlave(PinName sda, PinName scl);
+    ~I2CSlave();
+
+    void frequency(int hz);
+    int receive(void);
+    int read(char *data, int length);
+    int read(void);
+    int write(const char *data, int length);
+    int write(int data);
+
+    /**
+     * @param address: 8-bit I2C address, 0 disables the slave
+     */
+    void address(int address);
+    void stop(void);
+
+    // Simulation state
+    int sim_address;
+    sim::transaction_t *sim_pending;
+
+    // Interrupt of a slave served byte per byte instead of through receive(), reads sim_event
+    std::function<void()> sim_irq;
+    sim::bus_event_t sim_event;
+    bool sim_alert_response;
+};
+
+#endif // MBED_I2C_SLAVE_H
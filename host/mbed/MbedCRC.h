@@ -0,0 +1,80 @@
+#ifndef MBED_CRC_H
+#define MBED_CRC_H
+
+#include <cstdint>
+#include <cstddef>
+
+typedef enum crc_polynomial {
+    POLY_7BIT_SD = 0x09,
+    POLY_8BIT_CCITT = 0x07,
+    POLY_16BIT_CCITT = 0x1021,
+    POLY_16BIT_IBM = 0x8005,
+    POLY_32BIT_ANSI = 0x04C11DB7
+} crc_polynomial_t;
+
+typedef size_t crc_data_size_t;
+
+/**
+ * Bitwise CRC with the default mbed configuration of each polynomial
+ */
+template <uint32_t polynomial, int width>
+class MbedCRC {
+public:
+    int32_t compute(const void *buffer, crc_data_size_t size, uint32_t *crc)
+    {
+        compute_partial_start(crc);
+        compute_partial(buffer, size, crc);
+        return compute_partial_stop(crc);
+    }
+
+    int32_t compute_partial_start(uint32_t *crc)
+    {
+        *crc = initial_value();
+        return 0;
+    }
+
+    int32_t compute_partial(const void *buffer, crc_data_size_t size, uint32_t *crc)
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(buffer);
+        for (crc_data_size_t i = 0; i < size; i++) {
+            if (reflect()) {
+                *crc ^= data[i];
+                for (int bit = 0; bit < 8; bit++) {
+                    *crc = (*crc & 1) ? (*crc >> 1) ^ reflected_polynomial() : *crc >> 1;
+                }
+            } else {
+                *crc ^= (uint32_t) data[i] << (width - 8);
+                for (int bit = 0; bit < 8; bit++) {
+                    *crc = (*crc & top_bit()) ? (*crc << 1) ^ polynomial : *crc << 1;
+                }
+                *crc &= mask();
+            }
+        }
+        return 0;
+    }
+
+    int32_t compute_partial_stop(uint32_t *crc)
+    {
+        *crc = (*crc ^ final_xor()) & mask();
+        return 0;
+    }
+
+private:
+    static constexpr bool reflect() { return polynomial == POLY_32BIT_ANSI; }
+    static constexpr uint32_t initial_value() { return polynomial == POLY_32BIT_ANSI ? 0xFFFFFFFF : 0; }
+    static constexpr uint32_t final_xor() { return polynomial == POLY_32BIT_ANSI ? 0xFFFFFFFF : 0; }
+    static constexpr uint32_t mask() { return width == 32 ? 0xFFFFFFFF : (1UL << width) - 1; }
+    static constexpr uint32_t top_bit() { return 1UL << (width - 1); }
+    static constexpr uint32_t reflected_polynomial()
+    {
+        uint32_t result = 0;
+        for (int bit = 0; bit < width; bit++) {
+            if (polynomial & (1UL << bit)) {
+                result |= 1UL << (width - 1 - bit);
+            }
+        }
+        return result;
+    }
+};
+
+#endif // MBED_CRC_H
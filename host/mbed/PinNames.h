@@ -0,0 +1,41 @@
+#ifndef MBED_PINNAMES_H
+#define MBED_PINNAMES_H
+
+typedef enum {
+    PA_0 = 0x00, PA_1, PA_2, PA_3, PA_4, PA_5, PA_6, PA_7,
+    PA_8, PA_9, PA_10, PA_11, PA_12, PA_13, PA_14, PA_15,
+    PB_0 = 0x10, PB_1, PB_2, PB_3, PB_4, PB_5, PB_6, PB_7,
+    PB_8, PB_9, PB_10, PB_11, PB_12, PB_13, PB_14, PB_15,
+
+    I2C1_SCL = PB_6,
+    I2C1_SDA = PB_7,
+    I2C2_SCL = PA_11,
+    I2C2_SDA = PA_12,
+
+    // Not connected
+    NC = (int)0xFFFFFFFF
+} PinName;
+
+typedef enum {
+    PIN_INPUT,
+    PIN_OUTPUT
+} PinDirection;
+
+typedef enum {
+    PullNone = 0,
+    PullUp = 1,
+    PullDown = 2,
+    OpenDrain = 3,
+    PullDefault = PullNone
+} PinMode;
+
+// Same pins as TARGET_STM32G071GBU6
+#define LED_STATUS          PA_7
+#define LED_SENSOR          PB_5
+#define I2C_SENSOR_SDA      I2C2_SDA
+#define I2C_SENSOR_SCL      I2C2_SCL
+#define I2C_FRAMEWORK_SDA   I2C1_SDA
+#define I2C_FRAMEWORK_SCL   I2C1_SCL
+#define I2C_FRAMEWORK_ALERT PA_1
+
+#endif
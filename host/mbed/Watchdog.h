@@ -0,0 +1,30 @@
+#ifndef MBED_WATCHDOG_H
+#define MBED_WATCHDOG_H
+
+#include <cstdint>
+
+/**
+ * Watchdog on the simulated clock, sim::watchdog_expired() reports a missed kick
+ */
+class Watchdog {
+public:
+    static Watchdog &get_instance();
+
+    bool start(uint32_t timeout);
+    bool start();
+    bool stop();
+    void kick();
+    bool is_running() const;
+    uint32_t get_timeout() const;
+    uint32_t get_max_timeout() const;
+
+    // Simulation state
+    bool sim_running;
+    uint32_t sim_timeout;
+    uint32_t sim_last_kick;
+
+private:
+    Watchdog();
+};
+
+#endif // MBED_WATCHDOG_H
@@ -0,0 +1,28 @@
+/*
+ * Host stand-in for the subset of mbed-os used by the I2C framework.
+ * Drivers are backed by the simulated bus, flash, clock and pins of host/sim.
+ */
+
+#ifndef MBED_H
+#define MBED_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+
+#define DEVICE_I2C 1
+#define DEVICE_I2CSLAVE 1
+#define DEVICE_FLASH 1
+
+#include "PinNames.h"
+#include "mbed_hal.h"
+#include "MbedCRC.h"
+#include "I2C.h"
+#include "I2CSlave.h"
+#include "DigitalIn.h"
+#include "DigitalOut.h"
+#include "DigitalInOut.h"
+#include "Watchdog.h"
+
+#endif // MBED_H
@@ -0,0 +1,18 @@
+#ifndef MBED_HAL_H
+#define MBED_HAL_H
+
+#include <cstdint>
+
+// Microsecond clock, driven by the simulation
+uint32_t us_ticker_read();
+void wait_us(int us);
+void HAL_Delay(uint32_t ms);
+
+// Throws sim::SystemReset
+[[noreturn]] void NVIC_SystemReset();
+
+// Single threaded simulation, nothing to protect
+inline void core_util_critical_section_enter() {}
+inline void core_util_critical_section_exit() {}
+
+#endif // MBED_HAL_H
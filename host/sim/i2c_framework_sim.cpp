@@ -0,0 +1,75 @@
+/*
+ * Interrupt mode of the framework on the simulated bus, the I2C slave reports the events of a transaction
+ * byte per byte as the STM32 peripheral does from its interrupt.
+ */
+
+#include "i2c_framework.h"
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+
+// Framework served by the I2C interrupt
+I2C_Framework *I2C_Framework::instance = nullptr;
+
+void I2C_Framework::start_interrupt_slave()
+{
+    instance = this;
+
+    // Each node of the simulation has its own slave, its events go to the node owning it
+    slave.sim_irq = [this]() {
+        i2c_irq_handler();
+    };
+
+    // Alert response address is only enabled while ALERT# is asserted
+    set_alert_response(alert_asserted);
+}
+
+void I2C_Framework::i2c_irq()
+{
+    instance->i2c_irq_handler();
+}
+
+void I2C_Framework::i2c_irq_handler()
+{
+    sim::bus_event_t *event = &slave.sim_event;
+
+    switch(event->type){
+        case sim::bus_event_t::ADDRESS:
+            if(event->transmit && event->alert_response){
+                on_alert_response();
+            } else {
+                on_address_match(event->transmit, event->general_call);
+            }
+            break;
+
+        case sim::bus_event_t::RECEIVE:
+            on_receive_byte(event->data);
+            break;
+
+        case sim::bus_event_t::TRANSMIT:
+            // Sent once requested, no byte preloaded in a transmit register
+            event->data = on_transmit_byte();
+            break;
+
+        case sim::bus_event_t::STOP:
+            on_stop();
+            break;
+
+        case sim::bus_event_t::ARBITRATION_LOST:
+            // Peripheral releases the bus by itself, drop the transaction
+            on_arbitration_lost();
+            break;
+    }
+}
+
+void I2C_Framework::set_bus_timeout(bool enable)
+{
+    // No SMBus timeout hardware on the simulated bus, stuck lines are seen by sampling them
+    (void) enable;
+}
+
+void I2C_Framework::set_alert_response(bool enable)
+{
+    slave.sim_alert_response = enable;
+}
+
+#endif // I2C_FRAMEWORK_INTERRUPT_MODE
@@ -0,0 +1,155 @@
+/*
+ * Control of the simulated MCU and bus, used by host programs driving I2C_Framework.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include "mbed.h"
+#include "FlashIAP.h"
+#include <functional>
+#include <vector>
+
+// Simulated memory, mapped at the same addresses as on the STM32G071
+#define SIM_FLASH_ADDRESS (0x08000000)
+#define SIM_FLASH_SIZE (0x20000)
+#define SIM_FLASH_PAGE_SIZE (2048)
+#define SIM_FLASH_PROGRAM_SIZE (8)
+#define SIM_SYSTEM_MEMORY_ADDRESS (0x1FFF7000)
+#define SIM_SYSTEM_MEMORY_SIZE (0x1000)
+#define SIM_UID_ADDRESS (0x1FFF7590)
+
+// Flash timings of the STM32G0 datasheet
+#define SIM_FLASH_ERASE_TIME_US (22000)
+#define SIM_FLASH_PROGRAM_TIME_US (85)
+
+// SMBus Packet Error Checking of the master, on with the pec option of the framework
+#ifdef MBED_CONF_APP_PEC
+#define SIM_PEC MBED_CONF_APP_PEC
+#else
+#define SIM_PEC 0
+#endif
+
+// Address resolution of the framework, same as ARP_ADDRESS and ARP_ASSIGN_CMD
+#define SIM_ARP_ADDRESS (0x61)
+#define SIM_ARP_ASSIGN_CMD (0x01)
+
+// SMBus alert response address, same as ALERT_RESPONSE_ADDRESS, answered by alerting nodes served from their interrupt
+#define SIM_ALERT_RESPONSE_ADDRESS (0x0C)
+
+// Returned by a master read whose PEC does not match
+#define SIM_PEC_ERROR (2)
+
+// Exit code of an example which does not apply to the build (e.g. PEC on or off), a skipped test for ctest
+#define SIM_TEST_SKIPPED (77)
+
+namespace sim {
+
+// Thrown by NVIC_SystemReset()
+struct SystemReset {};
+
+// Transaction queued by the master for a slave
+struct transaction_t {
+    int type;
+    std::vector<char> data;
+    int read_length;
+    std::vector<char> response;
+    bool done;
+};
+
+// Flash activity counters
+struct flash_stats_t {
+    uint32_t erase_count;
+    uint32_t program_count;
+    uint64_t busy_time_us;
+};
+
+/**
+ * Add a node to the bus, service is run while the master waits for slaves and usually calls loop_iteration()
+ * A node is never served again while its service runs, so a node probing the bus as master does not recurse into itself
+ */
+void add_bus_node(std::function<void()> service);
+void clear_bus_nodes();
+
+// Run the service of every node once
+void run_bus_nodes();
+
+// Bus clock used to account transaction time on the simulated clock, 100 kHz by default
+void set_bus_frequency(int hz);
+
+/**
+ * Master transactions, address is the 7-bit address and 0 is the general call
+ * With SIM_PEC, a write is followed by its PEC and a read of length bytes takes one more byte, checked as its PEC,
+ * so reads of frames shorter than length have their PEC among the data and return SIM_PEC_ERROR
+ * Nodes served from their interrupt (interrupt mode) get the address, each byte and the stop as they happen,
+ * an alerting one also answers on SIM_ALERT_RESPONSE_ADDRESS and loses arbitration to a lower response
+ * @return 0 if at least one slave acknowledged the address, SIM_PEC_ERROR if the PEC of a read does not match
+ */
+int master_write(int address, const char *data, int length);
+int master_read(int address, char *data, int length);
+
+/**
+ * Write the register then read it back with a repeated start
+ * Only nodes served from their interrupt see the repeated start, polled nodes see a write then a read
+ */
+int master_read_register(int address, uint8_t reg, char *data, int length);
+
+/**
+ * Read the UID left by arbitration on the address resolution address, the lowest of the nodes waiting for an address
+ * @return 0 if a node answered
+ */
+int read_arp_uid(uint32_t *uid);
+
+/**
+ * Assign an address to the node with this UID, waiting on the address resolution address
+ * The UID is usually the one set with set_uid() or read with read_arp_uid()
+ * @param address: 7-bit address
+ * @return 0 if a node waiting for an address acknowledged the assignment
+ */
+int assign_address(uint32_t uid, int address);
+
+// SMBus CRC-8 of the address byte (7-bit address << 1, | 1 for a read) and the data
+uint8_t pec(uint8_t address_byte, const char *data, int length);
+
+// Noise on the bus: the next master write has a bit of its second byte flipped once its PEC is computed
+void corrupt_write();
+
+// Number of slaves currently answering on the bus
+int slave_count();
+
+// Simulated clock
+uint32_t now_us();
+void advance_us(uint32_t us);
+
+// Unique ID read by the next I2C_Framework constructed
+void set_uid(uint32_t id);
+
+// GPIO levels, all pins are high by default (I2C pull-ups)
+// Open drain: a pin is low while the MCU (drive_pin, from DigitalOut and DigitalInOut) or a device (set_pin) pulls it low
+int get_pin(PinName pin);
+void set_pin(PinName pin, int level);
+void drive_pin(PinName pin, int level);
+
+// Called each time the MCU drives a pin, e.g. a device counting the SCL clocks of a bus recovery
+void set_pin_hook(std::function<void(PinName pin, int level)> hook);
+
+// True if the watchdog was started and not kicked within its timeout
+bool watchdog_expired();
+
+// Checks of the examples run as tests, a failed check is printed and makes test_result() non-zero
+void check(bool condition, const char *description);
+
+// Exit code of an example, 1 if a check failed
+int test_result();
+
+// Simulated flash, memory is the image mapped at SIM_FLASH_ADDRESS
+uint8_t *flash_memory();
+void flash_erase_all();
+int flash_load(const char *path);
+int flash_save(const char *path);
+flash_stats_t flash_stats();
+void flash_reset_stats();
+
+} // namespace sim
+
+#endif // SIM_H
@@ -0,0 +1,437 @@
+#include "sim.h"
+#include "MbedCRC.h"
+#include <algorithm>
+
+namespace {
+
+std::vector<I2CSlave *> slaves;
+struct bus_node_t {
+    std::function<void()> service;
+    bool running;
+};
+std::vector<bus_node_t> bus_nodes;
+int bus_frequency = 100000;
+bool corrupt_next_write = false;
+
+// Slaves served from their interrupt addressed by a write ended with a repeated start
+std::vector<I2CSlave *> restarted_slaves;
+
+// Start, address byte, data bytes and stop, 9 clocks per byte
+void advance_bus_time(int length)
+{
+    sim::advance_us((uint32_t) ((uint64_t) (length + 1) * 9 * 1000000 / bus_frequency) + 1);
+}
+
+// Serve transactions, bounded in case a slave never answers
+#define SIM_BUS_SERVICE_ITERATIONS (1000)
+
+void wait_transactions(std::vector<sim::transaction_t> &transactions)
+{
+    for (int i = 0; i < SIM_BUS_SERVICE_ITERATIONS && !bus_nodes.empty(); i++) {
+        bool done = true;
+        for (sim::transaction_t &transaction : transactions) {
+            done = done && transaction.done;
+        }
+        if (done) {
+            break;
+        }
+        sim::run_bus_nodes();
+    }
+
+    // Remove transactions not served
+    for (I2CSlave *slave : slaves) {
+        for (sim::transaction_t &transaction : transactions) {
+            if (slave->sim_pending == &transaction) {
+                slave->sim_pending = nullptr;
+            }
+        }
+    }
+}
+
+std::vector<I2CSlave *> find_slaves(int address)
+{
+    std::vector<I2CSlave *> found;
+    for (I2CSlave *slave : slaves) {
+        if (slave->sim_address != 0 && (address == 0 || slave->sim_address == address)) {
+            found.push_back(slave);
+        } else if (slave->sim_alert_response && address == SIM_ALERT_RESPONSE_ADDRESS) {
+            found.push_back(slave);
+        }
+    }
+    return found;
+}
+
+// Interrupt of a slave served byte per byte, returns the byte it sends
+uint8_t raise_event(I2CSlave *slave, sim::bus_event_t::type_t type, uint8_t data)
+{
+    slave->sim_event.type = type;
+    slave->sim_event.data = data;
+    slave->sim_irq();
+    return slave->sim_event.data;
+}
+
+void raise_address(I2CSlave *slave, int address, bool transmit)
+{
+    slave->sim_event.transmit = transmit;
+    slave->sim_event.general_call = address == 0;
+    slave->sim_event.alert_response = address == SIM_ALERT_RESPONSE_ADDRESS;
+    raise_event(slave, sim::bus_event_t::ADDRESS, 0);
+}
+
+// Start of a transaction, slaves left by a repeated start and not addressed again see the stop
+void end_restarted(const std::vector<I2CSlave *> &targets)
+{
+    std::vector<I2CSlave *> restarted;
+    restarted.swap(restarted_slaves);
+    for (I2CSlave *slave : restarted) {
+        if (std::find(targets.begin(), targets.end(), slave) == targets.end() && slave->sim_irq) {
+            raise_event(slave, sim::bus_event_t::STOP, 0);
+        }
+    }
+}
+
+void end_transaction(const std::vector<I2CSlave *> &addressed, bool stop)
+{
+    for (I2CSlave *slave : addressed) {
+        if (!stop) {
+            restarted_slaves.push_back(slave);
+        } else if (slave->sim_irq) {
+            raise_event(slave, sim::bus_event_t::STOP, 0);
+        }
+    }
+}
+
+// Transactions on the bus as sent, without PEC
+// Slaves served from their interrupt get each byte, the others the whole transaction once done
+int bus_write(int address, const char *data, int length, bool stop)
+{
+    std::vector<I2CSlave *> targets = find_slaves(address);
+    end_restarted(targets);
+    if (targets.empty()) {
+        advance_bus_time(0);
+        return 1;
+    }
+    advance_bus_time(length);
+
+    std::vector<sim::transaction_t> transactions;
+    transactions.reserve(targets.size());
+    std::vector<I2CSlave *> interrupt_targets;
+    for (I2CSlave *slave : targets) {
+        if (slave->sim_irq) {
+            raise_address(slave, address, false);
+            for (int i = 0; i < length; i++) {
+                raise_event(slave, sim::bus_event_t::RECEIVE, data[i]);
+            }
+            interrupt_targets.push_back(slave);
+            continue;
+        }
+
+        transactions.emplace_back();
+        transactions.back().type = address == 0 ? I2CSlave::WriteGeneral : I2CSlave::WriteAddressed;
+        transactions.back().data.assign(data, data + length);
+        transactions.back().read_length = 0;
+        transactions.back().done = false;
+        slave->sim_pending = &transactions.back();
+    }
+
+    wait_transactions(transactions);
+    end_transaction(interrupt_targets, stop);
+    return 0;
+}
+
+int bus_read(int address, char *data, int length)
+{
+    std::vector<I2CSlave *> targets = find_slaves(address);
+    end_restarted(targets);
+    // Start and address byte, the slave serves the read once addressed and the data follows
+    advance_bus_time(0);
+    if (address == 0 || targets.empty()) {
+        return 1;
+    }
+
+    std::vector<sim::transaction_t> transactions(targets.size());
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i]->sim_irq) {
+            raise_address(targets[i], address, true);
+            transactions[i].done = true;
+            continue;
+        }
+        transactions[i].type = I2CSlave::ReadAddressed;
+        transactions[i].read_length = length;
+        transactions[i].done = false;
+        targets[i]->sim_pending = &transactions[i];
+    }
+
+    wait_transactions(transactions);
+    sim::advance_us((uint32_t) ((uint64_t) length * 9 * 1000000 / bus_frequency));
+
+    // Open drain bus, released lines read high. Slaves sending a 1 while the bus is 0 lose arbitration and stop
+    // driving, so several slaves on the same address leave the lowest response
+    std::vector<bool> driving(transactions.size(), true);
+    for (int i = 0; i < length; i++) {
+        // Slaves served from their interrupt send byte per byte while they drive the bus
+        for (size_t t = 0; t < transactions.size(); t++) {
+            if (driving[t] && targets[t]->sim_irq) {
+                transactions[t].response.resize(i + 1);
+                transactions[t].response[i] = raise_event(targets[t], sim::bus_event_t::TRANSMIT, 0);
+            }
+        }
+
+        data[i] = 0;
+        for (int bit = 7; bit >= 0; bit--) {
+            int level = 1;
+            for (size_t t = 0; t < transactions.size(); t++) {
+                if (driving[t] && (size_t) i < transactions[t].response.size()) {
+                    level &= (transactions[t].response[i] >> bit) & 1;
+                }
+            }
+            for (size_t t = 0; t < transactions.size(); t++) {
+                if (driving[t] && (size_t) i < transactions[t].response.size() && ((transactions[t].response[i] >> bit) & 1) != level) {
+                    driving[t] = false;
+                    if (targets[t]->sim_irq) {
+                        raise_event(targets[t], sim::bus_event_t::ARBITRATION_LOST, 0);
+                    }
+                }
+            }
+            data[i] |= level << bit;
+        }
+    }
+
+    // Slaves which lost arbitration released the bus and do not see the stop
+    std::vector<I2CSlave *> interrupt_targets;
+    for (size_t t = 0; t < transactions.size(); t++) {
+        if (driving[t] && targets[t]->sim_irq) {
+            interrupt_targets.push_back(targets[t]);
+        }
+    }
+    end_transaction(interrupt_targets, true);
+    return 0;
+}
+
+// Write of the master with its PEC, a repeated start follows if stop is false
+int send_write(int address, const char *data, int length, bool stop)
+{
+    std::vector<char> frame(data, data + length);
+#if SIM_PEC
+    // Address byte of a write, 0 for the general call
+    frame.push_back(sim::pec(address << 1, data, length));
+#endif
+
+    // After the PEC, as noise on the bus
+    if (corrupt_next_write && frame.size() > 1) {
+        frame[1] ^= 0x01;
+    }
+    corrupt_next_write = false;
+
+    return bus_write(address, frame.data(), (int) frame.size(), stop);
+}
+
+} // namespace
+
+namespace sim {
+
+void add_bus_node(std::function<void()> service)
+{
+    bus_nodes.push_back({service, false});
+}
+
+void clear_bus_nodes()
+{
+    bus_nodes.clear();
+}
+
+void run_bus_nodes()
+{
+    for (size_t i = 0; i < bus_nodes.size(); i++) {
+        if (!bus_nodes[i].running) {
+            bus_nodes[i].running = true;
+            bus_nodes[i].service();
+            bus_nodes[i].running = false;
+        }
+    }
+}
+
+void set_bus_frequency(int hz)
+{
+    bus_frequency = hz;
+}
+
+uint8_t pec(uint8_t address_byte, const char *data, int length)
+{
+    MbedCRC<POLY_8BIT_CCITT, 8> crc;
+    uint32_t value;
+    crc.compute_partial_start(&value);
+    crc.compute_partial(&address_byte, 1, &value);
+    crc.compute_partial(data, length, &value);
+    crc.compute_partial_stop(&value);
+    return value;
+}
+
+void corrupt_write()
+{
+    corrupt_next_write = true;
+}
+
+int master_write(int address, const char *data, int length)
+{
+    return send_write(address, data, length, true);
+}
+
+int master_read(int address, char *data, int length)
+{
+#if SIM_PEC
+    std::vector<char> frame(length + 1);
+    int rc = bus_read(address, frame.data(), length + 1);
+    memcpy(data, frame.data(), length);
+    if (rc == 0 && pec(address << 1 | 1, frame.data(), length) != (uint8_t) frame[length]) {
+        return SIM_PEC_ERROR;
+    }
+    return rc;
+#else
+    return bus_read(address, data, length);
+#endif
+}
+
+int master_read_register(int address, uint8_t reg, char *data, int length)
+{
+    char register_address = reg;
+    int rc = send_write(address, &register_address, 1, false);
+    if (rc != 0) {
+        return rc;
+    }
+    return master_read(address, data, length);
+}
+
+int read_arp_uid(uint32_t *uid)
+{
+    // MSB first, so arbitration keeps the lowest
+    char data[4];
+    if (master_read(SIM_ARP_ADDRESS, data, sizeof(data)) != 0) {
+        return -1;
+    }
+    *uid = (uint32_t) (uint8_t) data[0] << 24 | (uint8_t) data[1] << 16 | (uint8_t) data[2] << 8 | (uint8_t) data[3];
+    return 0;
+}
+
+int assign_address(uint32_t uid, int address)
+{
+    char assign[6] = {SIM_ARP_ASSIGN_CMD, (char) (uid >> 24), (char) (uid >> 16), (char) (uid >> 8), (char) uid, (char) address};
+    return master_write(SIM_ARP_ADDRESS, assign, sizeof(assign));
+}
+
+int slave_count()
+{
+    return (int) find_slaves(0).size();
+}
+
+} // namespace sim
+
+I2CSlave::I2CSlave(PinName sda, PinName scl) : sim_address(0), sim_pending(nullptr), sim_event(), sim_alert_response(false)
+{
+    slaves.push_back(this);
+}
+
+I2CSlave::~I2CSlave()
+{
+    for (size_t i = 0; i < slaves.size(); i++) {
+        if (slaves[i] == this) {
+            slaves.erase(slaves.begin() + i);
+            break;
+        }
+    }
+    restarted_slaves.erase(std::remove(restarted_slaves.begin(), restarted_slaves.end(), this), restarted_slaves.end());
+}
+
+void I2CSlave::frequency(int hz)
+{
+}
+
+int I2CSlave::receive(void)
+{
+    if (sim_pending == nullptr || sim_pending->done) {
+        return NoData;
+    }
+    return sim_pending->type;
+}
+
+int I2CSlave::read(char *data, int length)
+{
+    if (sim_pending == nullptr) {
+        return 1;
+    }
+
+    int count = (int) sim_pending->data.size() < length ? (int) sim_pending->data.size() : length;
+    memcpy(data, sim_pending->data.data(), count);
+    sim_pending->done = true;
+    sim_pending = nullptr;
+
+    // Same as mbed, non-zero when the master did not write length bytes
+    return count != length;
+}
+
+int I2CSlave::read(void)
+{
+    char data;
+    if (read(&data, 1) != 0) {
+        return -1;
+    }
+    return (uint8_t) data;
+}
+
+int I2CSlave::write(const char *data, int length)
+{
+    if (sim_pending == nullptr) {
+        return 1;
+    }
+
+    int count = sim_pending->read_length < length ? sim_pending->read_length : length;
+    sim_pending->response.assign(data, data + count);
+    sim_pending->done = true;
+    sim_pending = nullptr;
+
+    // Same as mbed, non-zero when the master did not read length bytes
+    return count != length;
+}
+
+int I2CSlave::write(int data)
+{
+    char byte = data;
+    return write(&byte, 1);
+}
+
+void I2CSlave::address(int address)
+{
+    sim_address = (address >> 1) & 0x7F;
+}
+
+void I2CSlave::stop(void)
+{
+}
+
+I2C::I2C(PinName sda, PinName scl) : _hz(100000)
+{
+}
+
+void I2C::frequency(int hz)
+{
+    _hz = hz;
+}
+
+// Master of a node, e.g. probing an address, sends no PEC
+int I2C::read(int address, char *data, int length, bool repeated)
+{
+    return bus_read((address >> 1) & 0x7F, data, length);
+}
+
+int I2C::write(int address, const char *data, int length, bool repeated)
+{
+    return bus_write((address >> 1) & 0x7F, data, length, true);
+}
+
+void I2C::start()
+{
+}
+
+void I2C::stop()
+{
+}
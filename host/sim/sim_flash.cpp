@@ -0,0 +1,165 @@
+#include "sim.h"
+#include <sys/mman.h>
+#include <cstdlib>
+
+namespace {
+
+sim::flash_stats_t stats;
+
+void *map_fixed(uintptr_t address, size_t size)
+{
+    void *memory = mmap((void *) address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (memory != (void *) address) {
+        fprintf(stderr, "sim: cannot map memory at 0x%lx\n", (unsigned long) address);
+        abort();
+    }
+    return memory;
+}
+
+// Map flash and system memory before any I2C_Framework is constructed, the framework reads them through raw pointers
+__attribute__((constructor(101))) void map_memory()
+{
+    map_fixed(SIM_FLASH_ADDRESS, SIM_FLASH_SIZE);
+    map_fixed(SIM_SYSTEM_MEMORY_ADDRESS, SIM_SYSTEM_MEMORY_SIZE);
+    sim::flash_erase_all();
+    sim::set_uid(0x12345678);
+}
+
+bool in_flash(uint32_t addr, uint32_t size)
+{
+    return addr >= SIM_FLASH_ADDRESS && size <= SIM_FLASH_SIZE && addr - SIM_FLASH_ADDRESS <= SIM_FLASH_SIZE - size;
+}
+
+} // namespace
+
+namespace sim {
+
+uint8_t *flash_memory()
+{
+    return (uint8_t *) SIM_FLASH_ADDRESS;
+}
+
+void flash_erase_all()
+{
+    memset(flash_memory(), 0xFF, SIM_FLASH_SIZE);
+}
+
+int flash_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return -1;
+    }
+    flash_erase_all();
+    size_t size = fread(flash_memory(), 1, SIM_FLASH_SIZE, file);
+    fclose(file);
+    return size > 0 ? 0 : -1;
+}
+
+int flash_save(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        return -1;
+    }
+    size_t size = fwrite(flash_memory(), 1, SIM_FLASH_SIZE, file);
+    fclose(file);
+    return size == SIM_FLASH_SIZE ? 0 : -1;
+}
+
+flash_stats_t flash_stats()
+{
+    return stats;
+}
+
+void flash_reset_stats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+} // namespace sim
+
+int FlashIAP::init()
+{
+    return 0;
+}
+
+int FlashIAP::deinit()
+{
+    return 0;
+}
+
+int FlashIAP::read(void *buffer, uint32_t addr, uint32_t size)
+{
+    if (!in_flash(addr, size)) {
+        return -1;
+    }
+    memcpy(buffer, (const void *) (uintptr_t) addr, size);
+    return 0;
+}
+
+int FlashIAP::program(const void *buffer, uint32_t addr, uint32_t size)
+{
+    // Like mbed FlashIAP, a last partial double word is padded with the erase value
+    uint32_t program_size = (size + SIM_FLASH_PROGRAM_SIZE - 1) / SIM_FLASH_PROGRAM_SIZE * SIM_FLASH_PROGRAM_SIZE;
+    if (!in_flash(addr, program_size) || addr % SIM_FLASH_PROGRAM_SIZE != 0) {
+        return -1;
+    }
+
+    uint8_t *target = (uint8_t *) (uintptr_t) addr;
+    for (uint32_t offset = 0; offset < program_size; offset += SIM_FLASH_PROGRAM_SIZE) {
+        // Like the STM32G0, programming a double word not erased fails
+        for (uint32_t i = 0; i < SIM_FLASH_PROGRAM_SIZE; i++) {
+            if (target[offset + i] != 0xFF) {
+                return -1;
+            }
+        }
+        uint32_t length = size - offset < SIM_FLASH_PROGRAM_SIZE ? size - offset : SIM_FLASH_PROGRAM_SIZE;
+        memcpy(&target[offset], (const uint8_t *) buffer + offset, length);
+
+        stats.program_count++;
+        stats.busy_time_us += SIM_FLASH_PROGRAM_TIME_US;
+        sim::advance_us(SIM_FLASH_PROGRAM_TIME_US);
+    }
+    return 0;
+}
+
+int FlashIAP::erase(uint32_t addr, uint32_t size)
+{
+    if (!in_flash(addr, size) || addr % SIM_FLASH_PAGE_SIZE != 0 || size % SIM_FLASH_PAGE_SIZE != 0) {
+        return -1;
+    }
+
+    memset((void *) (uintptr_t) addr, 0xFF, size);
+
+    uint32_t pages = size / SIM_FLASH_PAGE_SIZE;
+    stats.erase_count += pages;
+    stats.busy_time_us += (uint64_t) pages * SIM_FLASH_ERASE_TIME_US;
+    sim::advance_us(pages * SIM_FLASH_ERASE_TIME_US);
+    return 0;
+}
+
+uint32_t FlashIAP::get_page_size() const
+{
+    return SIM_FLASH_PROGRAM_SIZE;
+}
+
+uint32_t FlashIAP::get_sector_size(uint32_t addr) const
+{
+    return SIM_FLASH_PAGE_SIZE;
+}
+
+uint32_t FlashIAP::get_flash_start() const
+{
+    return SIM_FLASH_ADDRESS;
+}
+
+uint32_t FlashIAP::get_flash_size() const
+{
+    return SIM_FLASH_SIZE;
+}
+
+uint8_t FlashIAP::get_erase_value() const
+{
+    return 0xFF;
+}
@@ -0,0 +1,144 @@
+#include "sim.h"
+#include <map>
+
+namespace {
+
+uint64_t clock_us = 0;
+std::map<int, int> pins;
+std::map<int, int> driven_pins;
+std::function<void(PinName pin, int level)> pin_hook;
+int failed_checks = 0;
+
+} // namespace
+
+namespace sim {
+
+uint32_t now_us()
+{
+    return (uint32_t) clock_us;
+}
+
+void advance_us(uint32_t us)
+{
+    clock_us += us;
+}
+
+void set_uid(uint32_t id)
+{
+    memcpy((void *) SIM_UID_ADDRESS, &id, sizeof(id));
+}
+
+int get_pin(PinName pin)
+{
+    std::map<int, int>::iterator level = pins.find(pin);
+    std::map<int, int>::iterator driven = driven_pins.find(pin);
+    return (level == pins.end() || level->second) && (driven == driven_pins.end() || driven->second) ? 1 : 0;
+}
+
+void set_pin(PinName pin, int level)
+{
+    pins[pin] = level ? 1 : 0;
+}
+
+void drive_pin(PinName pin, int level)
+{
+    driven_pins[pin] = level ? 1 : 0;
+    if (pin_hook) {
+        pin_hook(pin, driven_pins[pin]);
+    }
+}
+
+void set_pin_hook(std::function<void(PinName pin, int level)> hook)
+{
+    pin_hook = hook;
+}
+
+bool watchdog_expired()
+{
+    Watchdog &watchdog = Watchdog::get_instance();
+    return watchdog.sim_running && now_us() - watchdog.sim_last_kick > watchdog.sim_timeout * 1000;
+}
+
+void check(bool condition, const char *description)
+{
+    if (!condition) {
+        printf("check failed: %s\n", description);
+        failed_checks++;
+    }
+}
+
+int test_result()
+{
+    return failed_checks == 0 ? 0 : 1;
+}
+
+} // namespace sim
+
+uint32_t us_ticker_read()
+{
+    return sim::now_us();
+}
+
+void wait_us(int us)
+{
+    sim::advance_us(us);
+}
+
+void HAL_Delay(uint32_t ms)
+{
+    sim::advance_us(ms * 1000);
+}
+
+void NVIC_SystemReset()
+{
+    throw sim::SystemReset();
+}
+
+Watchdog::Watchdog() : sim_running(false), sim_timeout(0), sim_last_kick(0)
+{
+}
+
+Watchdog &Watchdog::get_instance()
+{
+    static Watchdog watchdog;
+    return watchdog;
+}
+
+bool Watchdog::start(uint32_t timeout)
+{
+    sim_timeout = timeout;
+    return start();
+}
+
+bool Watchdog::start()
+{
+    sim_running = true;
+    sim_last_kick = sim::now_us();
+    return true;
+}
+
+bool Watchdog::stop()
+{
+    sim_running = false;
+    return true;
+}
+
+void Watchdog::kick()
+{
+    sim_last_kick = sim::now_us();
+}
+
+bool Watchdog::is_running() const
+{
+    return sim_running;
+}
+
+uint32_t Watchdog::get_timeout() const
+{
+    return sim_timeout;
+}
+
+uint32_t Watchdog::get_max_timeout() const
+{
+    return 32768;
+}
@@ -0,0 +1,153 @@
+#ifndef FIRMWARE_STAGER_H
+#define FIRMWARE_STAGER_H
+
+#include "mbed.h"
+#include "FlashIAP.h"
+
+// Values
+#define FIRMWARE_STAGE_RECORD_MAGIC (0x53544147)
+#define FIRMWARE_STAGE_PAGE_MAGIC (0x50414745)
+#define FIRMWARE_STAGE_HEADER_MAGIC (0xDEADBEEF)
+#define FIRMWARE_STAGE_PAGE_SIZE (2048)
+#define FIRMWARE_STAGE_MAX_PAGES (32)
+#define FIRMWARE_STAGE_CHUNK_SIZE (64)
+#define FIRMWARE_STAGE_MARKER_OFFSET (64)
+#define FIRMWARE_STAGE_STATUS_SIZE (6)
+
+// Commands, first byte written after the register
+// START: uint32 image size, SHA256 of the application, resumes the staged pages if the image is the same
+// DATA: uint32 image offset, uint8 length, length bytes of data (at most FIRMWARE_STAGE_CHUNK_SIZE), in order within a page
+// VERIFY: check CRC and SHA256 of the staged image against its header
+// INSTALL: reset into the bootloader to copy the verified image
+#define FIRMWARE_STAGE_START_CMD (0x01)
+#define FIRMWARE_STAGE_DATA_CMD (0x02)
+#define FIRMWARE_STAGE_VERIFY_CMD (0x03)
+#define FIRMWARE_STAGE_INSTALL_CMD (0x04)
+#define FIRMWARE_STAGE_START_SIZE (1 + 4 + 32)
+#define FIRMWARE_STAGE_DATA_HEADER_SIZE (1 + 4 + 1)
+#define FIRMWARE_STAGE_COMMAND_MAX_SIZE (FIRMWARE_STAGE_DATA_HEADER_SIZE + FIRMWARE_STAGE_CHUNK_SIZE)
+
+// States
+#define FIRMWARE_STAGE_IDLE (0)
+#define FIRMWARE_STAGE_RECEIVING (1)
+#define FIRMWARE_STAGE_BUSY (2)
+#define FIRMWARE_STAGE_VERIFIED (3)
+#define FIRMWARE_STAGE_ERROR (4)
+
+/**
+ * Staging area receiving a firmware image while the current one runs
+ * The image is the application header followed by the application, as placed from APPLICATION_HEADER_ADDRESS.
+ * Commands only copy data in RAM, flash is erased and programmed from process() in the main loop.
+ * A page is programmed once the master wrote all of it, then marked as staged in the status page (last page of the area),
+ * so a transfer interrupted by a reset resumes with the pages not marked yet.
+ * While BUSY, commands are dropped, the master polls the status and sends the dropped page again.
+ * Status: uint8 state (FIRMWARE_STAGE_*), uint8 number of pages of the image, uint32 bitmap of staged pages
+ */
+class FirmwareStager
+{
+
+public:
+    /**
+     * Constructor
+     * @param flash: flash holding the staging area, must be initialized before init()
+     * @param address: address of the staging area, page aligned
+     * @param size: size of the staging area, status page included
+     * @param application_offset: offset of the application after the header in the image
+    */
+    FirmwareStager(FlashIAP &flash, uint32_t address, uint32_t size, uint32_t application_offset);
+
+    /**
+     * Read the status page to resume a transfer started before the last reset
+    */
+    void init();
+
+    /**
+     * Handle a command written by the master, only copies data (safe from the I2C interrupt)
+     * @param command: command followed by its arguments
+     * @param size: number of bytes received
+    */
+    void write_command(const char *command, int size);
+
+    /**
+     * Run the flash work of the last command, to be called from the main loop
+    */
+    void process();
+
+    /**
+     * Fill the status read by the master
+     * @param status: buffer of FIRMWARE_STAGE_STATUS_SIZE bytes
+    */
+    void get_status(char *status);
+
+    /**
+     * True once the master asked to install a verified image
+    */
+    bool is_install_requested();
+
+    /**
+     * True while a command waits for process()
+    */
+    bool is_busy();
+
+    /**
+     * Number of bytes of a command, to find the end of a polled write
+     * @param command: command followed by its arguments
+    */
+    static int get_command_size(const char *command);
+
+private:
+
+    // Record written at the start of the status page by START
+    struct stage_record_t{
+        uint32_t magic;
+        uint32_t image_size;
+        unsigned char hash[32];
+    };
+
+    // Application header, header_format of mbed_app.json
+    struct image_header_t{
+        uint32_t magic;
+        uint64_t firmware_size;
+        uint32_t firmware_crc;
+        unsigned char firmware_version_hash[32];
+    }__attribute__((__packed__));
+
+    /**
+     * Resume the staged pages of the same image, else erase the status page and write a new record
+     */
+    int start();
+
+    /**
+     * Erase and program the page received in the page buffer, then mark it
+     */
+    int program_page();
+
+    /**
+     * Check that all pages are staged and that CRC and SHA256 of the application match the header
+     */
+    bool verify();
+
+    /**
+     * Number of pages of the image being staged
+     */
+    int get_page_count();
+
+    FlashIAP &flash;
+    uint32_t address;
+    uint32_t application_offset;
+    uint32_t status_address;
+    int max_pages;
+
+    volatile uint8_t state;
+    uint8_t pending_command;
+    volatile bool install_requested;
+    uint32_t image_size;
+    unsigned char image_hash[32];
+    uint32_t page_bitmap;
+    int page_index;
+    int page_fill;
+
+    char page_buffer[FIRMWARE_STAGE_PAGE_SIZE];
+};
+
+#endif // FIRMWARE_STAGER_H
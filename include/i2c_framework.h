@@ -4,6 +4,11 @@
 #include "mbed.h"
 #include "FlashIAP.h"
 #include "BlockDevice.h"
+#include "metadata_store.h"
+#include "firmware_stager.h"
+#include "i2c_register_map.h"
+#include "ring_buffer.h"
+#include "snapshot_buffer.h"
 #include <cstdio>
 
 #if !DEVICE_I2CSLAVE
@@ -18,6 +23,86 @@
 #error[NOT_SUPPORTED] FLASH is not supported
 #endif
 
+// Build options, set in mbed_app.json
+#ifdef MBED_CONF_APP_INTERRUPT_MODE
+#define I2C_FRAMEWORK_INTERRUPT_MODE MBED_CONF_APP_INTERRUPT_MODE
+#else
+#define I2C_FRAMEWORK_INTERRUPT_MODE 0
+#endif
+
+#ifdef MBED_CONF_APP_DMA_MODE
+#define I2C_FRAMEWORK_DMA_MODE MBED_CONF_APP_DMA_MODE
+#else
+#define I2C_FRAMEWORK_DMA_MODE 0
+#endif
+
+#ifdef MBED_CONF_APP_STATS
+#define I2C_FRAMEWORK_STATS MBED_CONF_APP_STATS
+#else
+#define I2C_FRAMEWORK_STATS 0
+#endif
+
+#ifdef MBED_CONF_APP_PEC
+#define I2C_FRAMEWORK_PEC MBED_CONF_APP_PEC
+#else
+#define I2C_FRAMEWORK_PEC 0
+#endif
+
+#ifdef MBED_CONF_APP_FIRMWARE_STAGING
+#define I2C_FRAMEWORK_FIRMWARE_STAGING MBED_CONF_APP_FIRMWARE_STAGING
+#else
+#define I2C_FRAMEWORK_FIRMWARE_STAGING 0
+#endif
+
+#ifdef MBED_CONF_APP_LOW_POWER
+#define I2C_FRAMEWORK_LOW_POWER MBED_CONF_APP_LOW_POWER
+#else
+#define I2C_FRAMEWORK_LOW_POWER 0
+#endif
+
+#ifdef MBED_CONF_APP_PREFETCH_MAX_AGE_US
+#define I2C_PREFETCH_MAX_AGE_US MBED_CONF_APP_PREFETCH_MAX_AGE_US
+#else
+#define I2C_PREFETCH_MAX_AGE_US (500)
+#endif
+
+#ifdef MBED_CONF_APP_MAX_BUS_MODE
+#define I2C_FRAMEWORK_MAX_BUS_MODE MBED_CONF_APP_MAX_BUS_MODE
+#else
+#define I2C_FRAMEWORK_MAX_BUS_MODE BUS_MODE_FAST_PLUS
+#endif
+
+#ifdef MBED_CONF_APP_STREAM_CHUNK_SIZE
+#define I2C_STREAM_CHUNK_SIZE MBED_CONF_APP_STREAM_CHUNK_SIZE
+#else
+#define I2C_STREAM_CHUNK_SIZE (128)
+#endif
+
+#ifdef MBED_CONF_APP_REGISTER_SLOTS
+#define I2C_USER_REGISTER_SLOTS MBED_CONF_APP_REGISTER_SLOTS
+#else
+#define I2C_USER_REGISTER_SLOTS (32)
+#endif
+
+// ALERT# pin, NC unless alert_pin names the pin the board wires to ALERT#
+#ifdef MBED_CONF_APP_ALERT_PIN
+#define I2C_FRAMEWORK_ALERT_PIN MBED_CONF_APP_ALERT_PIN
+#else
+#define I2C_FRAMEWORK_ALERT_PIN NC
+#endif
+
+#if I2C_FRAMEWORK_DMA_MODE && !I2C_FRAMEWORK_INTERRUPT_MODE
+#error[NOT_SUPPORTED] DMA mode requires interrupt mode
+#endif
+
+#if I2C_FRAMEWORK_LOW_POWER && !I2C_FRAMEWORK_INTERRUPT_MODE
+#error[NOT_SUPPORTED] Low power mode requires interrupt mode
+#endif
+
+#if I2C_USER_REGISTER_SLOTS < 0 || I2C_USER_REGISTER_SLOTS > 236
+#error[NOT_SUPPORTED] register_slots out of 0 to 236, the register index is 8-bit
+#endif
+
 // I2C Registers
 #define FIRMWARE_REG (0xA0)
 #define UID_REG (0xA1)
@@ -25,18 +110,199 @@
 #define GROUP_REG (0xA3)
 #define SENSOR_TYPE_REG (0xA4)
 #define NAME_REG (0xA5)
+#define METADATA_STATUS_REG (0xA6)
+#define STATS_REG (0xA7)
+#define STREAM_REG (0xA8)
+#define STREAM_STATUS_REG (0xA9)
+#define FIFO_LEVEL_REG (0xAA)
+#define FIFO_WATERMARK_REG (0xAB)
+#define FIFO_DRAIN_REG (0xAC)
+#define ALERT_STATUS_REG (0xAD)
+#define BUS_SPEED_REG (0xAE)
+#define FIRMWARE_STAGE_REG (0xAF)
+#define SYNC_REG (0xB0)
+#define POWER_STATS_REG (0xB1)
+#define BUS_HEALTH_REG (0xB2)
 
 // Flash Addresses
 #define FIRMWARE_STATUS_ADDRESS (0x0801FF00)
 #define APPLICATION_HEADER_ADDRESS (0x08009800)
+#define APPLICATION_ADDRESS (0x08009C00)
 #define APPLICATION_METADATA_ADDRESS (0x08009000)
+#define METADATA_LOG_ADDRESS (0x0801E800)
+#define METADATA_LOG_PAGE_COUNT (2)
+#define STAGING_ADDRESS (0x08013800)
+#define STAGING_SIZE (STAGING_ADDRESS - APPLICATION_HEADER_ADDRESS + FIRMWARE_STAGE_PAGE_SIZE)
 #define UNIQUE_ID_ADDR (0x1FFF7590)
 
+#if STAGING_ADDRESS + STAGING_SIZE > METADATA_LOG_ADDRESS
+#error Staging area overlaps the metadata log
+#endif
+
+#if I2C_FRAMEWORK_FIRMWARE_STAGING && defined(MBED_APP_START) && defined(MBED_APP_SIZE)
+#if MBED_APP_START + MBED_APP_SIZE > STAGING_ADDRESS
+#error[NOT_SUPPORTED] Firmware staging requires the application to end at STAGING_ADDRESS, set target.mbed_rom_size to 0x13800
+#endif
+#endif
+
+// Address resolution, SMBus ARP style
+// Unassigned nodes answer on ARP_ADDRESS: a read returns the 4 bytes UID MSB first, bus arbitration leaves the lowest UID,
+// a write of ARP_ASSIGN_CMD, UID (MSB first) and 7-bit address gives that address to the node with this UID
+#define ARP_ADDRESS (0x61)
+#define ARP_ASSIGN_CMD (0x01)
+#define ARP_TIMEOUT_MS (200)
+
+// Alert, SMBus style
+// ALERT# is an open-drain line pulled low while an enabled source is pending.
+// Reading ALERT_STATUS_REG returns the pending sources (ALERT_*) and clears them.
+// In interrupt mode an alerting node also answers a read on ALERT_RESPONSE_ADDRESS with its address (7-bit << 1),
+// bus arbitration leaves the lowest address and the node which sent it releases ALERT#
+#define ALERT_RESPONSE_ADDRESS (0x0C)
+#define ALERT_FIFO_WATERMARK (0x01)
+#define ALERT_DATA_READY (0x02)
+#define ALERT_ERROR (0x04)
+
+// Bus speed
+// BUS_SPEED_REG: uint8 highest mode supported (BUS_MODE_*), uint8 current mode, uint8 1 if FM+ drive is on
+// A general call of GENERAL_CALL_BUS_MODE_CMD followed by a mode switches all nodes once the transaction is over,
+// nodes go back to Standard-mode after a bus error or a reset
+#define BUS_MODE_STANDARD (0)
+#define BUS_MODE_FAST (1)
+#define BUS_MODE_FAST_PLUS (2)
+#define BUS_MODE_COUNT (3)
+#define BUS_SPEED_SIZE (3)
+
+// General call commands, first byte of a write on the general call address
+// GENERAL_CALL_GROUP_WRITE_CMD is followed by a group (GENERAL_CALL_ALL_GROUPS for all nodes), a register and its data,
+// every node of the group applies it like a write addressed to it, so one transaction configures a whole group
+// General calls are answered when polling too, on STM32 the address match code tells them apart from addressed writes.
+#define GENERAL_CALL_BUS_MODE_CMD (0x10)
+#define GENERAL_CALL_GROUP_WRITE_CMD (0x20)
+#define GENERAL_CALL_ALL_GROUPS (0)
+
+// Synchronised sampling
+// A general call of GENERAL_CALL_SYNC_LATCH_CMD latches the time of its end in every node and runs the sync hooks,
+// so all nodes sample at the same instant. A general call of GENERAL_CALL_TIME_SYNC_CMD followed by the master time
+// of the last latch (uint32 us, little endian) aligns the node time base on the master clock, FIFO timestamps use it.
+// Sending both periodically keeps nodes aligned despite the drift of their clocks.
+// SYNC_REG: uint32 time of the last latch, uint16 latch count, uint16 time sync count
+#define GENERAL_CALL_SYNC_LATCH_CMD (0x30)
+#define GENERAL_CALL_TIME_SYNC_CMD (0x31)
+#define SYNC_HOOK_COUNT (4)
+#define SYNC_STATUS_SIZE (8)
+
+// Packet Error Checking (pec option), SMBus CRC-8 x^8 + x^2 + x + 1
+// Reads end with a PEC over the read address byte and the data, writes end with a PEC over the write address byte,
+// the register and the data. Writes with a bad PEC are dropped before any handler runs.
+// When polling, the received length is unknown: the PEC is expected after the write size of the register,
+// else right after the register byte for a register selection. A polled read sends at most I2C_STREAM_FRAME_SIZE
+// bytes of data before its PEC, longer registers are cut there.
+
+// Low power (low_power option)
+// idle() enters Stop mode once no work with a deadline is pending, an address match wakes the MCU and SCL is
+// stretched until it runs again. A wakeup timer bounds Stop mode to STOP_MAX_TIME_MS so the watchdog is kicked in time.
+// POWER_STATS_REG: uint32 ms in run mode, uint32 ms in Stop mode, uint16 wakeups, uint16 last and max wake-up latency in us
+// (from the return of hal_deepsleep to the address match served: clocks are already restored there, their start-up
+// in Stop mode exit is not counted as the us ticker does not run in Stop mode)
+#define STOP_MAX_TIME_MS (WATCHDOG_TIMEOUT / 2)
+#define POWER_STATS_SIZE (14)
+
+// Bus health
+// SCL held low, or SDA held low while SCL is high, for BUS_STUCK_TIMEOUT_MS (SMBus tTIMEOUT) is a stuck bus.
+// It is seen by the SMBus timeout hardware in interrupt mode (SCL only) and by sampling the lines from loop_iteration().
+// Recovery drops the transaction, resets the I2C peripheral, clocks SCL until a device holding SDA releases it
+// (up to BUS_RECOVERY_CLOCKS and a STOP) then sets the peripheral up again in Standard-mode, without a reset.
+// A failed recovery raises ALERT_ERROR and is tried again after another timeout, the watchdog stays the last resort.
+// A flash erase or program of the node (up to 40 ms for a page) stalls it while it stretches SCL, the timeout is
+// suspended meanwhile.
+// Its error and the status LED are withdrawn once both lines are high again, unless another error is latched.
+// BUS_HEALTH_REG: uint16 SCL stuck, SDA stuck, hardware timeouts, bus errors, recoveries, failed recoveries,
+// uint16 duration of the last recovery in us
+#define BUS_LINE_SCL (1)
+#define BUS_LINE_SDA (2)
+#define BUS_STUCK_TIMEOUT_MS (25)
+#define BUS_STUCK_MIN_SAMPLES (4)
+#define BUS_RECOVERY_CLOCKS (9)
+#define BUS_HEALTH_SIZE (14)
+
+// Staged firmware update (firmware_staging option)
+// FIRMWARE_STAGE_REG takes FIRMWARE_STAGE_*_CMD commands (firmware_stager.h) and reads back the staging status.
+// The image (application header then application) is written to STAGING_ADDRESS while the current firmware runs,
+// the application region ends there (target.mbed_rom_size 0x13800). The staging area holds an image as large as the application
+// region (header included) followed by the status page, it ends before METADATA_LOG_ADDRESS.
+// INSTALL of a verified image sets MAGIC_FIRMWARE_STAGED and resets. This needs a bootloader which copies the staged image
+// over APPLICATION_HEADER_ADDRESS and clears the flag, it is not part of this repository. A flag still set at boot is
+// cleared and raises ALERT_ERROR if the staged image is not the running one.
+
+// Read prefetch
+// A write selecting a register resolves its read data (callback, register map handler or snapshot) when the register
+// byte arrives, so the read that follows, after a stop or a repeated start, only copies data. It is resolved again at
+// the end of the write if data bytes followed the register or the write handler selected another register.
+// A prefetch is used by the next read of the same register within I2C_PREFETCH_MAX_AGE_US (prefetch_max_age_us option),
+// else the data is resolved again when the master reads, so a master waiting on purpose between selection and read
+// gets fresh data. Register map entries and snapshots are prefetched unless marked otherwise, callbacks added with
+// add_i2c_callback() only once enabled with set_i2c_prefetch(). Registers built at read time are never prefetched.
+
+// Register slots
+// A register is looked up through a byte index into a slot array, unused registers share the slot of the default value.
+// Each register set by a callback, write buffer, prefetch setting, snapshot or register map takes a slot, up to
+// I2C_USER_REGISTER_SLOTS (register_slots option) besides the built-in registers, later ones are ignored.
+// A register bank takes a single slot whatever its size. Slots are kept until reset.
+
 // Values
 #define MAGIC_FIRMWARE_NEED_UPDATE (0xDEADBEEF)
+#define MAGIC_FIRMWARE_STAGED (0x57A6ED00)
 #define I2C_READ_DEFAULT_VALUE (0x42)
 #define I2C_FREQ (100000)
 #define WATCHDOG_TIMEOUT (5000)
+#define METADATA_COMMIT_DELAY_MS (100)
+#define I2C_REGISTER_COUNT (256)
+#define I2C_BUILTIN_REGISTER_SLOTS (16 + I2C_FRAMEWORK_STATS + I2C_FRAMEWORK_LOW_POWER + I2C_FRAMEWORK_FIRMWARE_STAGING)
+#define I2C_REGISTER_SLOTS (1 + I2C_BUILTIN_REGISTER_SLOTS + I2C_USER_REGISTER_SLOTS)
+#define I2C_BUFFER_SIZE (33)
+
+// Streaming, a frame is a header (uint16 length, uint16 sequence, little endian) followed by length bytes of data
+// Read on STREAM_REG: next frame of the TX stream, removed from it only once the master read the whole frame,
+// the register stays selected so frames are read back to back. An empty frame means no data.
+// Write on STREAM_REG: frame for the RX stream, accepted only if its sequence is the expected one and it fits.
+// STREAM_STATUS_REG: uint16 TX available, RX space, next TX sequence, next RX sequence
+#define I2C_STREAM_HEADER_SIZE (4)
+#define I2C_STREAM_FRAME_SIZE (I2C_STREAM_HEADER_SIZE + I2C_STREAM_CHUNK_SIZE)
+#define I2C_STREAM_STATUS_SIZE (8)
+// Sample FIFO, a record is a uint32 timestamp in us (time base of get_time()) followed by the sample, little endian
+// FIFO_LEVEL_REG: uint16 number of samples, uint8 flags (FIFO_FLAG_*), uint8 record size
+// FIFO_WATERMARK_REG: uint16 number of samples setting FIFO_FLAG_WATERMARK, default 1
+// Write on FIFO_DRAIN_REG: uint8 maximum number of samples per drain, default 255 for as many as fit in a read
+// Read on FIFO_DRAIN_REG: uint8 number of records followed by the records, removed once the master read all of them,
+// the register stays selected so drains are read back to back
+#define I2C_FIFO_MAX_SAMPLE_SIZE (32)
+#define I2C_FIFO_TIMESTAMP_SIZE (4)
+#define I2C_FIFO_LEVEL_SIZE (4)
+#define FIFO_FLAG_WATERMARK (0x01)
+#define FIFO_FLAG_OVERFLOW (0x02)
+#define I2C_LARGE_WRITE_SIZE (I2C_STREAM_FRAME_SIZE > FIRMWARE_STAGE_COMMAND_MAX_SIZE ? I2C_STREAM_FRAME_SIZE : FIRMWARE_STAGE_COMMAND_MAX_SIZE)
+// Register, largest write and its PEC, a polled write of a whole stream frame or firmware chunk fits with its PEC
+#define I2C_RX_BUFFER_SIZE (1 + (I2C_LARGE_WRITE_SIZE > I2C_BUFFER_SIZE - 1 ? I2C_LARGE_WRITE_SIZE : I2C_BUFFER_SIZE - 1) + I2C_FRAMEWORK_PEC)
+// A polled write is read without knowing its length, and mbed can wait up to a byte time for each byte asked but not sent.
+// So it asks for the largest write of a register (group write header and PEC included), and for I2C_RX_BUFFER_SIZE bytes
+// only when stream frames or firmware chunks can be written.
+#define I2C_POLLED_WRITE_SIZE (I2C_BUFFER_SIZE + 3)
+
+// Latency histograms, bucket i counts durations below 4^i us, last bucket counts the rest
+#define STATS_DISPATCH (0)
+#define STATS_CALLBACK (1)
+#define STATS_TRANSFER (2)
+#define STATS_FLASH_COMMIT (3)
+#define STATS_PHASE_COUNT (4)
+#define STATS_BUCKET_COUNT (10)
+
+#if I2C_FRAMEWORK_STATS
+#define STATS_START(start) uint32_t start = us_ticker_read()
+#define STATS_STOP(phase, start) stats_record(phase, us_ticker_read() - start)
+#else
+#define STATS_START(start)
+#define STATS_STOP(phase, start)
+#endif
 
 class I2C_Framework
 {
@@ -44,8 +310,9 @@ class I2C_Framework
 public:
     /**
      * Constructor
+     * @param alert: ALERT# pin, NC if none
     */
-    I2C_Framework(PinName sda, PinName scl);
+    I2C_Framework(PinName sda, PinName scl, PinName alert = I2C_FRAMEWORK_ALERT_PIN);
 
     /**
      * Initialize I2C framework
@@ -54,11 +321,13 @@ public:
 
     /**
      * Function to be called in main loop
+     * In interrupt mode, transactions are served from the I2C interrupt and this only runs background work
     */
     void loop_iteration();
 
     /**
      * Init the all the callbacks for the I2C slave
+     * Kept for compatibility, the register slots are statically sized to I2C_USER_REGISTER_SLOTS
      * @param size: number of callbacks
     */
     void init_i2c_callback_size(int size);
@@ -68,25 +337,501 @@ public:
      * @param register_address: register address to add callback
      * @param read_callback: function to be called when a read is requested, return a char * buffer with the data to be sent
      * @param write_callback: function to be called when a write is requested, buffer contains the data to be written (first is register), return the number of register for next read if needed else 0
+     * The read callback runs when the master reads, enable set_i2c_prefetch() after this call to run it on register selection
+     * Ignored if every register slot is used
     */
     void add_i2c_callback(int register_address, char * (*read_callback)(), int (*write_callback)(char *buffer), int data_size);
+
+    /**
+     * Write pending metadata changes to flash now, to be called before resetting the MCU
+    */
+    void flush_metadata();
+
+    /**
+     * Set a buffer receiving the data written to a register, without the register byte
+     * Data is received directly in this buffer (by DMA in DMA mode) and given to the write callback instead of the shared buffer
+     * @param register_address: register address to set the buffer for
+     * @param write_buffer: buffer receiving the data
+     * @param size: size of the buffer
+    */
+    void set_i2c_write_buffer(int register_address, char *write_buffer, int size);
+
+    /**
+     * Add the registers of a register map, handlers are called on context
+     * Replaces the callbacks added with add_i2c_callback() on the same registers
+     * M, map: type and register map with static storage (usually a constexpr array), e.g. <decltype(sensor_map), sensor_map>
+     * @param context: object the handlers are called on
+     * @return 0 on success, -1 if a data size is out of 1 to I2C_REGISTER_MAP_MAX_DATA_SIZE or the register slots left
+     * are too few (nothing is added)
+    */
+    template <typename M, M &map>
+    int add_i2c_register_map(typename i2c_register_map_traits<M>::context_t *context);
+
+    /**
+     * Allow or not the read data of a register to be resolved when the register is selected
+     * Allowed by default for register maps and snapshots, not for callbacks added with add_i2c_callback()
+     * @param register_address: register address
+     * @param enable: true if the read callback has no side effects, e.g. does not clear a status
+    */
+    void set_i2c_prefetch(int register_address, bool enable);
+
+    /**
+     * Serve a register from a snapshot, reads send the latest published value without calling application code
+     * Replaces the read callback of the register
+     * @param register_address: register address to serve
+     * @param snapshot: snapshot published by the application
+    */
+    void add_i2c_snapshot(int register_address, SnapshotBuffer *snapshot);
+
+    /**
+     * Map a RAM bank onto registers, EEPROM style: register first_register + i is byte i of the bank
+     * Reads send the bank from the register pointer to its end and writes store their data from it, without callbacks,
+     * so one transaction covers many adjacent registers. The pointer then moves past the bytes read or written,
+     * wrapping to first_register, so a read without register byte continues where the last transaction stopped.
+     * Writes need interrupt mode, a polled write has no known length and would store the rest of the receive buffer.
+     * @param first_register: first register of the bank, the bank ends before the built-in registers (FIRMWARE_REG)
+     * @param memory: bank memory, size bytes, read and written from the I2C interrupt in interrupt mode
+     * @param size: number of registers
+     * @param writable: true if the master can write the bank, else a write only sets the register pointer
+     * @return 0 on success, -1 if the bank does not fit before the built-in registers, is writable without interrupt mode
+     * or every register slot is used
+    */
+    int add_i2c_register_bank(int first_register, char *memory, int size, bool writable = false);
+
+    /**
+     * Set the ring buffers streamed through STREAM_REG, no callback runs per frame
+     * @param tx_stream: data pushed by the application and read by the master, nullptr if none
+     * @param rx_stream: data written by the master and read by the application, nullptr if none
+    */
+    void set_stream_buffers(RingBuffer *tx_stream, RingBuffer *rx_stream);
+
+    /**
+     * Set the ring buffer holding the samples of the FIFO registers
+     * @param fifo: ring buffer, pushed by push_sample() and drained by the master
+     * @param sample_size: size of a sample without timestamp, at most I2C_FIFO_MAX_SAMPLE_SIZE
+    */
+    void set_sample_fifo(RingBuffer *fifo, int sample_size);
+
+    /**
+     * Add a sample with the current timestamp to the FIFO
+     * @param sample: sample of sample_size bytes
+     * @return 0 on success, -1 if the FIFO is full, the sample is then dropped
+    */
+    int push_sample(const void *sample);
+
+    /**
+     * Set the alert sources asserting ALERT#, all by default
+     * @param mask: ALERT_* sources
+    */
+    void set_alert_mask(uint8_t mask);
+
+    /**
+     * Signal application conditions to the master, e.g. ALERT_DATA_READY after publishing a snapshot
+     * @param sources: ALERT_* sources
+    */
+    void raise_alert(uint8_t sources);
+
+    /**
+     * Add a hook run on each sync latch, in the I2C interrupt in interrupt mode so it must stay short (e.g. start a conversion)
+     * @param hook: called with its context and the latch time
+     * @param context: given to the hook
+     * @return 0 on success, -1 if SYNC_HOOK_COUNT hooks are already set
+    */
+    int add_sync_hook(void (*hook)(void *context, uint32_t timestamp), void *context);
+
+    /**
+     * Node time base in us, aligned on the master clock by time sync general calls
+    */
+    uint32_t get_time();
+
+    /**
+     * Wait for the next transaction in Stop mode, to be called from the main loop after loop_iteration()
+     * Returns at once without the low_power option or while work is pending
+     * @param max_time_ms: longest time in Stop mode, at most STOP_MAX_TIME_MS
+     * @return time spent in Stop mode in us, the us ticker does not count it
+    */
+    uint32_t idle(uint32_t max_time_ms = STOP_MAX_TIME_MS);
+
+    // Time spent in each power state and wake-up latency, also read from POWER_STATS_REG
+    struct power_stats_t{
+        uint32_t run_time_ms;
+        uint32_t stop_time_ms;
+        uint16_t wakeup_count;
+        uint16_t last_wake_latency_us;
+        uint16_t max_wake_latency_us;
+    };
+
+    /**
+     * Get the power state statistics, all zero without the low_power option
+    */
+    void get_power_stats(power_stats_t *stats);
+
+    // Stuck bus detection and recovery counters, also read from BUS_HEALTH_REG
+    struct bus_health_t{
+        uint16_t scl_stuck_count;
+        uint16_t sda_stuck_count;
+        uint16_t timeout_count;
+        uint16_t bus_error_count;
+        uint16_t recovery_count;
+        uint16_t failed_recovery_count;
+        uint16_t last_recovery_us;
+    };
+
+    /**
+     * Get the bus health counters
+    */
+    void get_bus_health(bus_health_t *health);
     
 private:
 
     /**
-     * Setup I2C slave with a random address
+     * Set the table entries of a register map, one handler function per register
+     */
+    template <typename M, M &map, size_t... I>
+    void set_register_map(typename i2c_register_map_traits<M>::context_t *context, std::index_sequence<I...>);
+
+    /**
+     * Call the handlers of register I of a register map, known at compile time so the call is direct
+     */
+    template <typename M, M &map, size_t I>
+    static int map_read(void *context, i2c_span_t data);
+    template <typename M, M &map, size_t I>
+    static int map_write(void *context, i2c_span_t data);
+
+    /**
+     * Setup I2C slave on the last address saved in metadata if it is still free,
+     * else on ARP_ADDRESS, waiting for the master to assign an address
      */
     void setup_i2c();
 
     /**
-     * Save metadata from RAM (active_app_metadata_save) to flash (active_app_metadata)
+     * Find a free address alone with a random delay and a probe, when no master assigned one in ARP_TIMEOUT_MS
+     * Legacy fallback: two nodes probing at the same time can take the same address, only ARP is collision free.
+     * Blocks for up to a second and one probe per address, if every address answers it stays on ARP_ADDRESS
+     * and probes again after another ARP_TIMEOUT_MS.
+     */
+    void probe_i2c_address();
+
+    /**
+     * Answer on a new address and save it in metadata for next boot
+     * @param address: 7-bit address
+     */
+    void set_slave_address(uint16_t address);
+
+    /**
+     * Check if an address can be used by a node
+     * @param address: 7-bit address
+     */
+    bool is_valid_address(uint16_t address);
+
+    /**
+     * Handle a write on the general call address, buffer[0] is the command
+     */
+    void process_general_call(char *buffer);
+
+    /**
+     * Apply the register write of a group write general call, buffer[2] is the register
+     */
+    void process_group_write(char *buffer);
+
+    /**
+     * Switch master and slave to a bus mode
+     * @param mode: BUS_MODE_*
+     */
+    void set_bus_mode(int mode);
+
+    /**
+     * Enable Fast-mode Plus drive of the I2C pins (target specific, nothing on other targets)
+     */
+    void set_fast_mode_plus(bool enable);
+
+    /**
+     * Answer general calls when polling, the mbed slave is set up with them off (target specific)
+     */
+    void enable_general_call();
+
+    /**
+     * Check if the polled write being addressed is a general call, for targets whose I2CSlave reports it as an
+     * addressed write (target specific, false on other targets)
+     */
+    bool is_general_call();
+
+#if I2C_FRAMEWORK_LOW_POWER
+    /**
+     * Check that nothing waits on the us ticker, which stops in Stop mode
+     */
+    bool is_idle();
+
+    /**
+     * Clock the I2C peripheral from a clock running in Stop mode (target specific)
+     */
+    void setup_low_power();
+
+    /**
+     * Enter Stop mode if idle and no transfer is in progress (target specific)
+     * @param max_time_us: wakeup timer
+     * @return time spent in Stop mode in us, 0 if not entered
+     */
+    uint32_t enter_stop_mode(uint32_t max_time_us);
+#endif
+
+    /**
+     * Handle a write on ARP_ADDRESS, buffer[0] is the command
+     */
+    void process_arp_write(char *buffer);
+
+    /**
+     * Serve one polled transaction of the I2C slave if any
+     */
+    void poll_slave();
+
+    /**
+     * Save metadata from RAM (active_app_metadata_ram) to the metadata log
+     * Metadata page read by the bootloader (active_app_metadata_flash) is only rewritten when the update flag changes
      */
     void save_metadata_to_flash();
 
+    /**
+     * Set the flag of the bootloader to install the staged image and restart MCU
+     */
+    void install_staged_firmware();
+
     /**
      * Check if I2C scl signal is ok, reset watchdog if it is
     */
-    void check_scl();    
+    void check_scl();
+
+    /**
+     * Sample SCL and SDA, recover the bus once a line is held low for BUS_STUCK_TIMEOUT_MS or the hardware timed out
+     */
+    void check_bus();
+
+    /**
+     * Drop the transaction, release the lines and set the I2C peripheral up again
+     * @param line: BUS_LINE_* held low, 0 for a hardware timeout
+     */
+    void recover_bus(uint8_t line);
+
+    /**
+     * Reset the I2C peripheral and clock SCL until SDA is released, then send a STOP if SDA was held (target specific)
+     * The lines are the sda and scl pins of the constructor
+     */
+    void release_bus();
+
+    /**
+     * Around flash erase and program of this node, which stall the CPU while the peripheral stretches SCL:
+     * the hardware timeout is off and the line sampling restarts afterwards, this is not a stuck bus
+     */
+    void suspend_bus_timeout();
+    void resume_bus_timeout();
+
+    /**
+     * Point every register to the default value slot and give the built-in registers their slots
+     */
+    void init_register_table();
+
+    /**
+     * Resolve the data to send for a register
+     * @param reg: register read by the master
+     * @param size: set to the number of bytes to send
+     * @return pointer to the data to send
+     */
+    const char *get_read_data(uint8_t reg, int *size);
+
+    /**
+     * Data to send for the current register, prefetched if still valid else resolved now
+     * @param size: set to the number of bytes to send
+     */
+    const char *take_read_data(int *size);
+
+    /**
+     * Resolve the read data of a register selected by a write, if it can be prefetched
+     * @param reg: register selected for the next read
+     */
+    void prefetch_read(uint8_t reg);
+
+    /**
+     * Handle data written by the master, buffer[0] is the register
+     * Registers with a write buffer get their data from it
+     * @param buffer: data received from the master
+     */
+    void process_write(char *buffer);
+
+    /**
+     * Resolve where the data written to a register is received
+     * @param reg: register written by the master
+     * @param size: set to the size of the returned buffer
+     * @return buffer receiving the data following the register byte
+     */
+    char *get_write_target(uint8_t reg, int *size);
+
+    /**
+     * End a read of a frame built from a ring buffer, its data is removed once the master read all of it
+     * @param complete: true if the whole frame was sent
+     */
+    void end_frame_read(bool complete);
+
+    /**
+     * Set register to 0 after a read, streaming registers stay selected for back-to-back reads
+     * and the pointer of a register bank is moved once the read is over
+     */
+    void end_register_read();
+
+    /**
+     * Move the pointer of a register bank past the bytes read or written, wrapping to its first register
+     * @param reg: register the transaction started at
+     * @param count: number of bytes read or written
+     */
+    void advance_bank_pointer(uint8_t reg, int count);
+
+    /**
+     * Number of data bytes written to a register, after the register byte
+     * @param buffer: data received from the master, buffer[0] is the register
+     */
+    int get_write_size(char *buffer);
+
+    /**
+     * Number of data bytes written to a register of this node, buffer[0] is the register
+     */
+    int get_register_write_size(char *buffer);
+
+#if I2C_FRAMEWORK_PEC
+    /**
+     * Compute the PEC of a transaction
+     * @param address_byte: address byte with the read/write bit
+     * @param header: bytes following the address, e.g. the register
+     * @param data: data following the header
+     */
+    uint8_t compute_pec(uint8_t address_byte, const char *header, int header_size, const char *data, int size);
+
+    /**
+     * Check the PEC ending a write and remove it from the received data
+     * @return true if the PEC matches
+     */
+    bool check_write_pec();
+
+    /**
+     * Same for a polled write, whose length is unknown
+     */
+    bool check_polled_write_pec();
+
+    /**
+     * 7-bit address the node currently answers on
+     */
+    uint8_t get_own_address();
+#endif
+
+    /**
+     * Latch alert conditions and drive ALERT# accordingly
+     */
+    void update_alert();
+
+    /**
+     * Light the status LED and raise ALERT_ERROR, both stay latched until reset
+     */
+    void raise_error();
+
+    /**
+     * Mark metadata in RAM as modified, it is saved from loop_iteration() once no write happened for METADATA_COMMIT_DELAY_MS
+     */
+    void request_metadata_save();
+
+    /**
+     * Transaction events, called from the I2C interrupt in interrupt mode
+     */
+    void on_address_match(bool transmit, bool general_call);
+    void on_receive_byte(uint8_t data);
+    uint8_t on_transmit_byte();
+    void on_stop();
+    void on_bus_error();
+
+    /**
+     * Handle the write received, at a stop or at the repeated start of the read following it
+     */
+    void end_write();
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    void on_alert_response();
+    void on_bus_timeout();
+
+    /**
+     * Arbitration lost while sending, not an error during an alert response where a lower address wins
+     */
+    void on_arbitration_lost();
+#endif
+
+    /**
+     * Drop the data of the transaction in progress
+     */
+    void abort_transaction();
+
+#if I2C_FRAMEWORK_STATS
+    /**
+     * Count a duration in the histogram of a phase
+     * @param phase: STATS_DISPATCH, STATS_CALLBACK, STATS_TRANSFER or STATS_FLASH_COMMIT
+     * @param duration: duration in us
+     */
+    void stats_record(int phase, uint32_t duration);
+#endif
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    /**
+     * Take over the I2C peripheral and serve transactions from its interrupt (target specific)
+     */
+    void start_interrupt_slave();
+
+    /**
+     * I2C interrupt handler (target specific)
+     */
+    void i2c_irq_handler();
+    static void i2c_irq();
+
+    /**
+     * Answer on ALERT_RESPONSE_ADDRESS or not (target specific)
+     */
+    void set_alert_response(bool enable);
+
+    /**
+     * Enable or not the SMBus timeout hardware set up by start_interrupt_slave() (target specific)
+     */
+    void set_bus_timeout(bool enable);
+    static I2C_Framework *instance;
+#endif
+
+#if I2C_FRAMEWORK_DMA_MODE
+    /**
+     * DMA transfers between I2C and memory (target specific)
+     */
+    void start_tx_dma(const char *data, int size);
+    void start_rx_dma(char *data, int size);
+    void stop_dma();
+    void dma_irq_handler();
+    static void dma_irq();
+#endif
+
+    /**
+     * Built-in write handlers, buffer[0] is the register
+     */
+    void write_firmware_reg(char *buffer);
+    void write_group_reg(char *buffer);
+    void write_sensor_type_reg(char *buffer);
+    void write_name_reg(char *buffer);
+    void write_stream_reg(char *buffer);
+    void write_fifo_watermark_reg(char *buffer);
+    void write_fifo_drain_reg(char *buffer);
+    void write_firmware_stage_reg(char *buffer);
+    void write_register_bank(char *buffer);
+
+    /**
+     * Built-in read handlers for data built at read time
+     * @param size: set to the number of bytes to send
+     */
+    const char *read_stream_reg(int *size);
+    const char *read_stream_status_reg(int *size);
+    const char *read_fifo_level_reg(int *size);
+    const char *read_fifo_drain_reg(int *size);
+    const char *read_alert_status_reg(int *size);
+    const char *read_firmware_stage_reg(int *size);
+    const char *read_sync_reg(int *size);
     
     // Application header structure
     struct app_header_t{
@@ -102,28 +847,224 @@ private:
         uint32_t group;
         char sensor_type[32];
         char name[32];
+        uint16_t slave_addr;
+    };
+
+    // Register slot structure, a bank slot holds the whole bank and is shared by its registers
+    struct i2c_register_entry_t{
+        char * (*read_callback)();
+        int (*write_callback)(char *buffer);
+        void (I2C_Framework::*builtin_write)(char *buffer);
+        const char *(I2C_Framework::*builtin_read)(int *size);
+        SnapshotBuffer *snapshot;
+        int write_size;
+        const char *read_data;
+        int data_size;
+        char *write_buffer;
+        int write_buffer_size;
+        void *map_context;
+        int (*map_read)(void *context, i2c_span_t data);
+        int (*map_write)(void *context, i2c_span_t data);
+        int bank_first;
+        int bank_size;
+        bool prefetch;
     };
 
+    /**
+     * Slot of a register, shared with other registers for the default value and banks
+     * @param reg: register address
+     */
+    i2c_register_entry_t *get_register_entry(uint8_t reg);
+
+    /**
+     * Slot of a register to set, a register on the default value or in a bank takes a new slot set to the default value
+     * @param reg: register address
+     * @return slot of the register, nullptr if every slot is used
+     */
+    i2c_register_entry_t *get_register_slot(uint8_t reg);
+
+    /**
+     * @param reg: register address
+     * @return true if setting the register takes a new slot
+     */
+    bool needs_register_slot(uint8_t reg);
+
+    /**
+     * Take the next slot, set to the default value
+     * @return index of the slot, 0 if every slot is used
+     */
+    uint8_t allocate_register_slot();
+
     I2C master;
     FlashIAP flash;
+    MetadataStore metadata_store;
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    FirmwareStager firmware_stager;
+#endif
     Watchdog *watchdog;
     I2CSlave slave;
 
     DigitalIn scl_status;
+    DigitalIn sda_status;
     DigitalOut led_status;
+    DigitalInOut alert_line;
+    PinName bus_sda;
+    PinName bus_scl;
     app_header_t *active_app_header;
     app_metadata_t *active_app_metadata_flash;
     app_metadata_t active_app_metadata_ram;
     uint32_t id;
     uint16_t slave_addr;
+    bool address_assigned;
+    uint32_t arp_start_time;
+    char arp_uid[4];
     uint8_t i2c_register;
-    uint32_t **i2c_callback_array;
+    uint8_t i2c_register_index[I2C_REGISTER_COUNT];
+    i2c_register_entry_t i2c_register_slots[I2C_REGISTER_SLOTS];
+    int i2c_register_slot_count;
     int slave_action;
-    int i2c_callback_array_size;
     int rc;
     char register_address[1];
-    char buffer[33];
+    char buffer[I2C_RX_BUFFER_SIZE];
+    char map_tx_buffer[I2C_REGISTER_MAP_MAX_DATA_SIZE];
+    const char *tx_data;
+    int tx_size;
+    int tx_index;
+    int tx_bank_register;
+    volatile int prefetch_register;
+    const char *prefetch_data;
+    int prefetch_size;
+    uint32_t prefetch_time;
+    int rx_length;
+    int polled_rx_size;
+    char *rx_target;
+    int rx_target_size;
+    bool rx_general_call;
+#if I2C_FRAMEWORK_PEC
+    uint8_t tx_pec;
+    int rx_dropped;
+    char rx_last_byte;
+#endif
+    RingBuffer *tx_stream;
+    RingBuffer *rx_stream;
+    uint16_t tx_stream_sequence;
+    uint16_t rx_stream_sequence;
+    RingBuffer *fifo;
+    int fifo_record_size;
+    uint16_t fifo_watermark;
+    uint8_t fifo_drain_count;
+    volatile bool fifo_overflow;
+    int bus_mode;
+    volatile int bus_mode_request;
+    uint8_t bus_speed[BUS_SPEED_SIZE];
+    void (*sync_hooks[SYNC_HOOK_COUNT])(void *context, uint32_t timestamp);
+    void *sync_hook_contexts[SYNC_HOOK_COUNT];
+    volatile uint32_t time_offset;
+    volatile uint32_t latch_time;
+    volatile uint16_t latch_count;
+    volatile uint16_t time_sync_count;
+    power_stats_t power_stats;
+#if I2C_FRAMEWORK_LOW_POWER
+    uint32_t power_state_start;
+    uint32_t power_run_us;
+    uint32_t power_stop_us;
+    volatile bool wake_pending;
+    volatile uint32_t wake_time;
+#endif
+    bus_health_t bus_health;
+    uint8_t bus_stuck_line;
+    uint32_t bus_stuck_start;
+    int bus_stuck_samples;
+    volatile bool bus_timeout_pending;
+    bool bus_recovery_failed;
+    bool error_latched;
+    volatile uint8_t alert_status;
+    uint8_t alert_mask;
+    bool alert_fifo_watermark;
+    bool alert_asserted;
+    volatile bool alert_responded;
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    bool alert_response_pending;
+    char alert_response;
+#endif
+    RingBuffer *tx_frame_ring;
+    int tx_frame_consume;
+    char tx_frame[I2C_STREAM_FRAME_SIZE + 1];
+    volatile uint8_t metadata_commit_pending;
+    volatile uint32_t metadata_change_time;
+#if I2C_FRAMEWORK_STATS
+    uint16_t stats_histogram[STATS_PHASE_COUNT][STATS_BUCKET_COUNT];
+    uint32_t stats_transfer_start;
+#endif
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    bool tx_preloaded;
+#endif
+#if I2C_FRAMEWORK_DMA_MODE
+    bool rx_dma_active;
+    int rx_dma_size;
+    bool tx_dma_active;
+    int tx_dma_size;
+#endif
 };
 
+template <typename M, M &map>
+int I2C_Framework::add_i2c_register_map(typename i2c_register_map_traits<M>::context_t *context)
+{
+    static_assert(i2c_register_map_traits<M>::size <= I2C_USER_REGISTER_SLOTS, "Register map larger than the register slots");
+
+    // Sizes out of range are only caught at compile time for constexpr maps
+    for(size_t i = 0; i < i2c_register_map_traits<M>::size; i++){
+        if(map[i].data_size <= 0 || map[i].data_size > I2C_REGISTER_MAP_MAX_DATA_SIZE){
+            return -1;
+        }
+    }
+
+    // Registers without a slot of their own take one
+    int new_slots = 0;
+    for(size_t i = 0; i < i2c_register_map_traits<M>::size; i++){
+        if(needs_register_slot(map[i].register_address)){
+            new_slots++;
+        }
+    }
+    if(i2c_register_slot_count + new_slots > I2C_REGISTER_SLOTS){
+        return -1;
+    }
+
+    set_register_map<M, map>(context, std::make_index_sequence<i2c_register_map_traits<M>::size>());
+    return 0;
+}
+
+template <typename M, M &map, size_t... I>
+void I2C_Framework::set_register_map(typename i2c_register_map_traits<M>::context_t *context, std::index_sequence<I...>)
+{
+    int (*const reads[])(void *context, i2c_span_t data) = {(map[I].read != nullptr ? &I2C_Framework::map_read<M, map, I> : nullptr)...};
+    int (*const writes[])(void *context, i2c_span_t data) = {(map[I].write != nullptr ? &I2C_Framework::map_write<M, map, I> : nullptr)...};
+
+    for(size_t i = 0; i < sizeof...(I); i++){
+        i2c_register_entry_t *entry = get_register_slot(map[i].register_address);
+        entry->read_callback = nullptr;
+        entry->write_callback = nullptr;
+        entry->snapshot = nullptr;
+        entry->map_context = context;
+        entry->map_read = reads[i];
+        entry->map_write = writes[i];
+        entry->data_size = map[i].data_size;
+        entry->write_size = map[i].data_size;
+        entry->prefetch = map[i].prefetch;
+    }
+}
+
+template <typename M, M &map, size_t I>
+int I2C_Framework::map_read(void *context, i2c_span_t data)
+{
+    return (static_cast<typename i2c_register_map_traits<M>::context_t *>(context)->*(map[I].read))(data);
+}
+
+template <typename M, M &map, size_t I>
+int I2C_Framework::map_write(void *context, i2c_span_t data)
+{
+    return (static_cast<typename i2c_register_map_traits<M>::context_t *>(context)->*(map[I].write))(data);
+}
+
 
 #endif // I2C_FRAMEWORK_H
\ No newline at end of file
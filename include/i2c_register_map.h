@@ -0,0 +1,91 @@
+#ifndef I2C_REGISTER_MAP_H
+#define I2C_REGISTER_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Values
+#define I2C_REGISTER_MAP_MAX_DATA_SIZE (32)
+
+/**
+ * Data of a transaction given to register handlers
+ */
+struct i2c_span_t{
+    char *data;
+    int size;
+};
+
+// Not constexpr, reaching it while building a constexpr register map fails to compile
+inline int i2c_register_data_size_out_of_range()
+{
+    return 0;
+}
+
+/**
+ * Register of a register map, handlers are members of T called on the object given to add_i2c_register_map()
+ * The map is a template argument of add_i2c_register_map(), so each handler is called directly, not through a pointer
+ * read: fills the span (data_size bytes) with the data to send, returns the number of bytes to send
+ * write: gets the data written after the register byte, returns the register for next read
+ * Either handler can be nullptr
+ * prefetch: false if reading has side effects, read is then only called once the master reads the register
+ *
+ * Example:
+ *     constexpr i2c_register_handler_t<Sensor> sensor_map[] = {
+ *         {0x10, &Sensor::read_temperature, nullptr, 2},
+ *         {0x11, &Sensor::read_config, &Sensor::write_config, 4},
+ *     };
+ *     static_assert(i2c_register_map_is_valid(sensor_map), "Register defined twice");
+ *     i2c_framework.add_i2c_register_map<decltype(sensor_map), sensor_map>(&sensor);
+ */
+template <typename T>
+struct i2c_register_handler_t{
+    constexpr i2c_register_handler_t(uint8_t register_address, int (T::*read)(i2c_span_t data), int (T::*write)(i2c_span_t data), int data_size, bool prefetch = true) :
+        register_address(register_address),
+        read(read),
+        write(write),
+        data_size(data_size > 0 && data_size <= I2C_REGISTER_MAP_MAX_DATA_SIZE ? data_size : i2c_register_data_size_out_of_range()),
+        prefetch(prefetch)
+    {
+    }
+
+    uint8_t register_address;
+    int (T::*read)(i2c_span_t data);
+    int (T::*write)(i2c_span_t data);
+    int data_size;
+    bool prefetch;
+};
+
+/**
+ * Object type and number of registers of a register map, M is the type of the map
+ */
+template <typename M>
+struct i2c_register_map_traits;
+
+template <typename T, size_t N>
+struct i2c_register_map_traits<const i2c_register_handler_t<T>[N]>{
+    typedef T context_t;
+    static constexpr size_t size = N;
+};
+
+template <typename T, size_t N>
+struct i2c_register_map_traits<i2c_register_handler_t<T>[N]> : i2c_register_map_traits<const i2c_register_handler_t<T>[N]>{
+};
+
+/**
+ * Check at compile time that no register is defined twice in a register map
+ */
+template <typename T, size_t N>
+constexpr bool i2c_register_map_is_valid(const i2c_register_handler_t<T> (&map)[N])
+{
+    for(size_t i = 0; i < N; i++){
+        for(size_t j = i + 1; j < N; j++){
+            if(map[i].register_address == map[j].register_address){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#endif // I2C_REGISTER_MAP_H
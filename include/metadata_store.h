@@ -0,0 +1,121 @@
+#ifndef METADATA_STORE_H
+#define METADATA_STORE_H
+
+#include "mbed.h"
+#include "FlashIAP.h"
+
+// Values
+#define METADATA_RECORD_MAGIC (0x4D455441)
+#define METADATA_STORE_MAX_RECORD_SIZE (256)
+
+/**
+ * Append-only log of fixed size records spread over several flash pages
+ * Each save appends a record with a sequence number and a CRC, the latest valid record wins.
+ * A page is erased only when the active page is full, the latest record is then rewritten in the erased page.
+ * An interrupted program leaves a record with a bad CRC and an interrupted erase leaves the previous page intact,
+ * so the latest complete record always survives a power loss.
+ * Records keep their data size, a page holds records of a single size. Records written by a firmware with another
+ * data size are still loaded, and the next save starts a new page with the current size.
+ */
+class MetadataStore
+{
+
+public:
+    /**
+     * Constructor
+     * @param flash: flash used to store the log, must be initialized before init()
+     * @param address: address of the first page of the log
+     * @param page_count: number of pages of the log, at least 2
+     * @param data_size: size of the data saved in each record
+    */
+    MetadataStore(FlashIAP &flash, uint32_t address, int page_count, uint32_t data_size);
+
+    /**
+     * Scan the log and index the latest valid record
+     * @return 0 if a valid record was found
+    */
+    int init();
+
+    /**
+     * Read data of the latest valid record
+     * Data of a shorter record from an older firmware is copied at the start, the rest of data is left unchanged
+     * @param data: buffer of data_size bytes
+     * @return 0 on success, -1 if the log is empty
+    */
+    int load(void *data);
+
+    /**
+     * Check if the latest record has another data size than the current one, it should then be saved again
+    */
+    bool needs_migration();
+
+    /**
+     * Append a new record, does nothing if data did not change
+     * @param data: buffer of data_size bytes
+     * @return 0 on success
+    */
+    int save(const void *data);
+
+private:
+
+    /**
+     * Check if a record slot is valid
+     * @param address: address of the slot
+     * @param slot_size: size of the slots of the page
+     * @param sequence: set to the sequence number of the record
+     * @param size: set to the data size of the record
+     * @return true if magic, size and CRC are valid
+     */
+    bool read_record(uint32_t address, uint32_t slot_size, uint32_t *sequence, uint32_t *size);
+
+    /**
+     * Size of the slot of a record, aligned on program size
+     * @param size: data size of the record
+     */
+    uint32_t get_slot_size(uint32_t size);
+
+    /**
+     * Size of the slots of a page, given by its first record, the current one if the page is blank
+     */
+    uint32_t get_page_slot_size(uint32_t page_address);
+
+    /**
+     * Check if a flash area is erased
+     */
+    bool is_blank(uint32_t address, uint32_t size);
+
+    // Record header, followed by data and padding to program size
+    struct record_header_t{
+        uint32_t magic;
+        uint32_t crc;
+        uint32_t sequence;
+        uint32_t size;
+    };
+
+    /**
+     * Compute CRC of a record in the record buffer, it covers sequence, size and data
+     * @param size: data size of the record
+     */
+    uint32_t compute_crc(uint32_t size);
+
+    FlashIAP &flash;
+    uint32_t address;
+    int page_count;
+    uint32_t page_size;
+    uint32_t data_size;
+    uint32_t program_size;
+    uint32_t record_size;
+
+    // Index of the latest record
+    bool has_record;
+    uint32_t latest_address;
+    uint32_t latest_sequence;
+    uint32_t latest_size;
+    int active_page;
+    uint32_t active_slot_size;
+    uint32_t write_offset;
+
+    char record[METADATA_STORE_MAX_RECORD_SIZE];
+};
+
+#endif // METADATA_STORE_H
@@ -0,0 +1,63 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstdint>
+
+/**
+ * Byte ring buffer over a storage given by the user, no allocation
+ * Safe without locking for one producer and one consumer, e.g. the application and the I2C interrupt
+ */
+class RingBuffer
+{
+
+public:
+    /**
+     * Constructor
+     * @param storage: memory of the ring buffer
+     * @param size: size of storage, only the largest power of two below it is used
+    */
+    RingBuffer(char *storage, uint32_t size);
+
+    /**
+     * Append data (producer side)
+     * @return number of bytes appended, less than length if the buffer is full
+    */
+    uint32_t write(const char *data, uint32_t length);
+
+    /**
+     * Remove data (consumer side)
+     * @return number of bytes read
+    */
+    uint32_t read(char *data, uint32_t length);
+
+    /**
+     * Copy data without removing it (consumer side)
+     * @return number of bytes copied
+    */
+    uint32_t peek(char *data, uint32_t length);
+
+    /**
+     * Remove data without copying it (consumer side)
+    */
+    void skip(uint32_t length);
+
+    /**
+     * Number of bytes that can be read
+    */
+    uint32_t available();
+
+    /**
+     * Number of bytes that can be written
+    */
+    uint32_t space();
+
+private:
+    char *storage;
+    uint32_t mask;
+
+    // Free running indexes, only written by the producer (head) and the consumer (tail)
+    volatile uint32_t head;
+    volatile uint32_t tail;
+};
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,73 @@
+#ifndef SNAPSHOT_BUFFER_H
+#define SNAPSHOT_BUFFER_H
+
+#include <cstdint>
+
+/**
+ * Triple buffer holding the latest complete value of a register
+ * The application publishes from its own context, the I2C slave acquires the latest value with an index swap.
+ * The buffer being sent is never written, so a multi-byte value is never torn and no application code runs during the transfer.
+ * Safe without locking for one publisher and one reader on a single core, either side may be an interrupt.
+ */
+class SnapshotBuffer
+{
+
+public:
+    /**
+     * Constructor
+     * @param storage: memory of the 3 buffers, 3 * size bytes
+     * @param size: size of the value
+    */
+    SnapshotBuffer(char *storage, int size);
+
+    /**
+     * Publish a new value (publisher side)
+     * @param data: value of size bytes
+    */
+    void publish(const void *data);
+
+    /**
+     * Get the latest published value and keep it until the next acquire (reader side)
+    */
+    const char *acquire();
+
+    /**
+     * Size of the value
+    */
+    int get_size();
+
+private:
+    char *storage;
+    int size;
+
+    // Buffer of the latest value, only written by the publisher
+    volatile uint8_t latest;
+    // Buffer being sent, only written by the reader
+    volatile uint8_t reading;
+};
+
+/**
+ * Snapshot of a value of type T with its own storage
+ */
+template <typename T>
+class I2CSnapshot : public SnapshotBuffer
+{
+
+public:
+    I2CSnapshot() : SnapshotBuffer(snapshot_storage, sizeof(T))
+    {
+    }
+
+    /**
+     * Publish a new value
+    */
+    void publish(const T &value)
+    {
+        SnapshotBuffer::publish(&value);
+    }
+
+private:
+    char snapshot_storage[3 * sizeof(T)];
+};
+
+#endif // SNAPSHOT_BUFFER_H
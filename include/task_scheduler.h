@@ -0,0 +1,114 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include "mbed.h"
+#include "i2c_framework.h"
+
+// Values
+#define TASK_SCHEDULER_MAX_TASKS (8)
+
+/**
+ * Cooperative run-to-completion scheduler of the main loop, no RTOS
+ * The I2C framework is serviced before every task, so a task delays I2C service by its own duration only.
+ * Periodic tasks are released every period with a deadline at the next release, deadline tasks are released
+ * once by schedule() with their own deadline. The released task with the earliest deadline runs first.
+ * Time base is the us ticker plus the time spent in Stop mode, so periods hold with the low_power option.
+ */
+class TaskScheduler
+{
+
+public:
+    // Execution time accounting of a task, in us
+    struct task_stats_t{
+        uint32_t run_count;
+        uint32_t total_time_us;
+        uint32_t last_time_us;
+        uint32_t max_time_us;
+        uint32_t missed_deadlines;
+    };
+
+    /**
+     * Constructor
+     * @param framework: I2C framework serviced first, initialized before run()
+    */
+    TaskScheduler(I2C_Framework &framework);
+
+    /**
+     * Add a task released every period, the first release is one period after it is added
+     * @param task: called with its context, must return within its period
+     * @param context: given to the task
+     * @param period_us: period in us
+     * @return task id, -1 if TASK_SCHEDULER_MAX_TASKS tasks are already added
+    */
+    int add_periodic_task(void (*task)(void *context), void *context, uint32_t period_us);
+
+    /**
+     * Add a task run once each time it is scheduled
+     * @return task id, -1 if TASK_SCHEDULER_MAX_TASKS tasks are already added
+    */
+    int add_deadline_task(void (*task)(void *context), void *context);
+
+    /**
+     * Release a deadline task now, safe from an interrupt
+     * @param id: task id of add_deadline_task()
+     * @param deadline_us: time from now the task must be done by
+    */
+    void schedule(int id, uint32_t deadline_us);
+
+    /**
+     * Service the I2C framework and run the released task with the earliest deadline if any
+     * @return time until the next release in us, 0 if a task is still released
+    */
+    uint32_t run_once();
+
+    /**
+     * Run tasks forever, idle (Stop mode with the low_power option) until the next release
+    */
+    void run();
+
+    /**
+     * Scheduler time base in us
+    */
+    uint32_t get_time();
+
+    /**
+     * Get the execution time accounting of a task
+     * @param id: task id
+    */
+    void get_task_stats(int id, task_stats_t *stats);
+
+private:
+
+    // Task entry
+    struct task_t{
+        void (*function)(void *context);
+        void *context;
+        uint32_t period_us;
+        uint32_t release_time;
+        uint32_t deadline;
+        volatile bool released;
+        task_stats_t stats;
+    };
+
+    /**
+     * Add a task entry
+     */
+    int add_task(void (*task)(void *context), void *context, uint32_t period_us);
+
+    /**
+     * Release the periodic tasks whose release time passed
+     */
+    void release_tasks(uint32_t now);
+
+    /**
+     * Run a task and account its execution time
+     */
+    void run_task(task_t *task);
+
+    I2C_Framework &framework;
+    task_t tasks[TASK_SCHEDULER_MAX_TASKS];
+    int task_count;
+    uint32_t stop_time_us;
+};
+
+#endif // TASK_SCHEDULER_H
@@ -1,14 +1,15 @@
 #include "mbed.h"
 #include "i2c_framework.h"
+#include "task_scheduler.h"
 
 I2C_Framework i2c_framework(I2C_FRAMEWORK_SDA, I2C_FRAMEWORK_SCL);
+// Application tasks are added here, I2C is serviced before each of them
+TaskScheduler scheduler(i2c_framework);
 
 int main()
 {
     i2c_framework.init();
-    
-    while (true)
-    {
-        i2c_framework.loop_iteration();
-    }
+
+    // Stop mode between tasks and transactions with the low_power option
+    scheduler.run();
 }
\ No newline at end of file
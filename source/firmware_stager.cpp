@@ -0,0 +1,287 @@
+#include "firmware_stager.h"
+#include "mbedtls/sha256.h"
+
+FirmwareStager::FirmwareStager(FlashIAP &flash, uint32_t address, uint32_t size, uint32_t application_offset) : flash(flash), address(address), application_offset(application_offset)
+{
+    // Last page holds the record and the page markers
+    status_address = address + size - FIRMWARE_STAGE_PAGE_SIZE;
+    max_pages = size / FIRMWARE_STAGE_PAGE_SIZE - 1;
+    if(max_pages > FIRMWARE_STAGE_MAX_PAGES){
+        max_pages = FIRMWARE_STAGE_MAX_PAGES;
+    }
+
+    state = FIRMWARE_STAGE_IDLE;
+    pending_command = 0;
+    install_requested = false;
+    image_size = 0;
+    memset(image_hash, 0, sizeof(image_hash));
+    page_bitmap = 0;
+    page_index = -1;
+    page_fill = 0;
+}
+
+void FirmwareStager::init()
+{
+    stage_record_t record;
+    if(flash.read(&record, status_address, sizeof(stage_record_t)) != 0 || record.magic != FIRMWARE_STAGE_RECORD_MAGIC){
+        return;
+    }
+
+    image_size = record.image_size;
+    memcpy(image_hash, record.hash, sizeof(image_hash));
+    if(get_page_count() > max_pages){
+        return;
+    }
+
+    // Pages marked before the reset are kept
+    uint32_t marker[2];
+    page_bitmap = 0;
+    for(int page = 0; page < get_page_count(); page++){
+        if(flash.read(marker, status_address + FIRMWARE_STAGE_MARKER_OFFSET + page * sizeof(marker), sizeof(marker)) == 0 && marker[0] == FIRMWARE_STAGE_PAGE_MAGIC && marker[1] == (uint32_t) page){
+            page_bitmap |= 1UL << page;
+        }
+    }
+    state = FIRMWARE_STAGE_RECEIVING;
+}
+
+void FirmwareStager::write_command(const char *command, int size)
+{
+    // Previous command still running, master polls the status
+    if(size < 1 || state == FIRMWARE_STAGE_BUSY){
+        return;
+    }
+
+    switch(command[0]){
+    case FIRMWARE_STAGE_START_CMD:{
+        if(size < FIRMWARE_STAGE_START_SIZE){
+            return;
+        }
+        uint32_t new_size = (uint8_t) command[1] | (uint8_t) command[2] << 8 | (uint8_t) command[3] << 16 | (uint32_t) (uint8_t) command[4] << 24;
+        if(new_size <= application_offset || new_size > (uint32_t) max_pages * FIRMWARE_STAGE_PAGE_SIZE){
+            state = FIRMWARE_STAGE_ERROR;
+            return;
+        }
+        image_size = new_size;
+        memcpy(image_hash, &command[5], sizeof(image_hash));
+        break;
+    }
+    case FIRMWARE_STAGE_DATA_CMD:{
+        if(state != FIRMWARE_STAGE_RECEIVING || size < FIRMWARE_STAGE_DATA_HEADER_SIZE){
+            return;
+        }
+        uint32_t offset = (uint8_t) command[1] | (uint8_t) command[2] << 8 | (uint8_t) command[3] << 16 | (uint32_t) (uint8_t) command[4] << 24;
+        int length = (uint8_t) command[5];
+        if(length == 0 || length > FIRMWARE_STAGE_CHUNK_SIZE || FIRMWARE_STAGE_DATA_HEADER_SIZE + length > size || offset >= image_size || (uint32_t) length > image_size - offset){
+            return;
+        }
+
+        // Page already staged, e.g. sent again after a resume
+        int page = offset / FIRMWARE_STAGE_PAGE_SIZE;
+        int page_offset = offset % FIRMWARE_STAGE_PAGE_SIZE;
+        if(page_bitmap & (1UL << page)){
+            return;
+        }
+
+        // A page is received in order, its first chunk restarts it
+        if(page_offset == 0){
+            page_index = page;
+            page_fill = 0;
+        }
+        if(page != page_index || page_offset != page_fill || page_offset + length > FIRMWARE_STAGE_PAGE_SIZE){
+            return;
+        }
+        memcpy(&page_buffer[page_fill], &command[FIRMWARE_STAGE_DATA_HEADER_SIZE], length);
+        page_fill += length;
+
+        // Program once the page or the image is complete
+        if(page_fill < FIRMWARE_STAGE_PAGE_SIZE && offset + length < image_size){
+            return;
+        }
+        break;
+    }
+    case FIRMWARE_STAGE_VERIFY_CMD:
+        if(state != FIRMWARE_STAGE_RECEIVING && state != FIRMWARE_STAGE_VERIFIED){
+            return;
+        }
+        break;
+    case FIRMWARE_STAGE_INSTALL_CMD:
+        if(state == FIRMWARE_STAGE_VERIFIED){
+            install_requested = true;
+        }
+        return;
+    default:
+        return;
+    }
+
+    pending_command = command[0];
+    state = FIRMWARE_STAGE_BUSY;
+}
+
+void FirmwareStager::process()
+{
+    if(state != FIRMWARE_STAGE_BUSY){
+        return;
+    }
+
+    int rc = 0;
+    switch(pending_command){
+    case FIRMWARE_STAGE_START_CMD:
+        rc = start();
+        break;
+    case FIRMWARE_STAGE_DATA_CMD:
+        rc = program_page();
+        break;
+    case FIRMWARE_STAGE_VERIFY_CMD:
+        if(verify()){
+            state = FIRMWARE_STAGE_VERIFIED;
+            return;
+        }
+        // Bad image, the next START sends all pages again instead of resuming
+        page_bitmap = 0;
+        flash.erase(status_address, FIRMWARE_STAGE_PAGE_SIZE);
+        state = FIRMWARE_STAGE_ERROR;
+        return;
+    }
+
+    state = rc == 0 ? FIRMWARE_STAGE_RECEIVING : FIRMWARE_STAGE_ERROR;
+}
+
+void FirmwareStager::get_status(char *status)
+{
+    status[0] = state;
+    status[1] = state != FIRMWARE_STAGE_IDLE ? get_page_count() : 0;
+    for(int i = 0; i < 4; i++){
+        status[2 + i] = page_bitmap >> (8 * i);
+    }
+}
+
+bool FirmwareStager::is_install_requested()
+{
+    return install_requested;
+}
+
+bool FirmwareStager::is_busy()
+{
+    return state == FIRMWARE_STAGE_BUSY;
+}
+
+int FirmwareStager::get_command_size(const char *command)
+{
+    switch(command[0]){
+    case FIRMWARE_STAGE_START_CMD:
+        return FIRMWARE_STAGE_START_SIZE;
+    case FIRMWARE_STAGE_DATA_CMD:{
+        int length = (uint8_t) command[5];
+        return FIRMWARE_STAGE_DATA_HEADER_SIZE + (length < FIRMWARE_STAGE_CHUNK_SIZE ? length : FIRMWARE_STAGE_CHUNK_SIZE);
+    }
+    default:
+        return 1;
+    }
+}
+
+int FirmwareStager::start()
+{
+    page_index = -1;
+    page_fill = 0;
+
+    // Same image as the record, keep the staged pages
+    stage_record_t record;
+    int rc = flash.read(&record, status_address, sizeof(stage_record_t));
+    if(rc == 0 && record.magic == FIRMWARE_STAGE_RECORD_MAGIC && record.image_size == image_size && memcmp(record.hash, image_hash, sizeof(image_hash)) == 0){
+        return 0;
+    }
+
+    // New image, pages are erased one by one as they are received
+    page_bitmap = 0;
+    rc = flash.erase(status_address, FIRMWARE_STAGE_PAGE_SIZE);
+    if(rc != 0){
+        return rc;
+    }
+    record.magic = FIRMWARE_STAGE_RECORD_MAGIC;
+    record.image_size = image_size;
+    memcpy(record.hash, image_hash, sizeof(image_hash));
+    return flash.program(&record, status_address, sizeof(stage_record_t));
+}
+
+int FirmwareStager::program_page()
+{
+    uint32_t page_address = address + page_index * FIRMWARE_STAGE_PAGE_SIZE;
+
+    // Pad the last page to the program size
+    uint32_t program_size = flash.get_page_size();
+    int program_length = (page_fill + program_size - 1) / program_size * program_size;
+    memset(&page_buffer[page_fill], flash.get_erase_value(), program_length - page_fill);
+
+    int rc = flash.erase(page_address, FIRMWARE_STAGE_PAGE_SIZE);
+    if(rc != 0){
+        return rc;
+    }
+    rc = flash.program(page_buffer, page_address, program_length);
+    if(rc != 0){
+        return rc;
+    }
+
+    // Marker written last, an interrupted page is received again
+    uint32_t marker[2] = {FIRMWARE_STAGE_PAGE_MAGIC, (uint32_t) page_index};
+    rc = flash.program(marker, status_address + FIRMWARE_STAGE_MARKER_OFFSET + page_index * sizeof(marker), sizeof(marker));
+    if(rc != 0){
+        return rc;
+    }
+
+    page_bitmap |= 1UL << page_index;
+    page_index = -1;
+    page_fill = 0;
+    return 0;
+}
+
+bool FirmwareStager::verify()
+{
+    int page_count = get_page_count();
+    uint32_t all_pages = page_count < 32 ? (1UL << page_count) - 1 : 0xFFFFFFFF;
+    if(page_bitmap != all_pages){
+        return false;
+    }
+
+    image_header_t header;
+    if(flash.read(&header, address, sizeof(image_header_t)) != 0){
+        return false;
+    }
+    if(header.magic != FIRMWARE_STAGE_HEADER_MAGIC || header.firmware_size > image_size - application_offset){
+        return false;
+    }
+    if(memcmp(header.firmware_version_hash, image_hash, sizeof(image_hash)) != 0){
+        return false;
+    }
+
+    // CRC and SHA256 of the application, read through the page buffer
+    MbedCRC<POLY_32BIT_ANSI, 32> crc;
+    uint32_t crc_value;
+    unsigned char hash[32];
+    mbedtls_sha256_context sha256;
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts_ret(&sha256, 0);
+    crc.compute_partial_start(&crc_value);
+
+    bool valid = true;
+    uint32_t firmware_size = header.firmware_size;
+    for(uint32_t offset = 0; offset < firmware_size; offset += FIRMWARE_STAGE_PAGE_SIZE){
+        uint32_t length = firmware_size - offset < FIRMWARE_STAGE_PAGE_SIZE ? firmware_size - offset : FIRMWARE_STAGE_PAGE_SIZE;
+        if(flash.read(page_buffer, address + application_offset + offset, length) != 0){
+            valid = false;
+            break;
+        }
+        crc.compute_partial(page_buffer, length, &crc_value);
+        mbedtls_sha256_update_ret(&sha256, (const unsigned char *) page_buffer, length);
+    }
+
+    crc.compute_partial_stop(&crc_value);
+    mbedtls_sha256_finish_ret(&sha256, hash);
+    mbedtls_sha256_free(&sha256);
+
+    return valid && crc_value == header.firmware_crc && memcmp(hash, header.firmware_version_hash, sizeof(hash)) == 0;
+}
+
+int FirmwareStager::get_page_count()
+{
+    return (image_size + FIRMWARE_STAGE_PAGE_SIZE - 1) / FIRMWARE_STAGE_PAGE_SIZE;
+}
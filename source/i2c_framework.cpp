@@ -1,17 +1,61 @@
 #include "i2c_framework.h"
 #include <cstdio>
 
-I2C_Framework::I2C_Framework(PinName sda, PinName scl) : slave(sda, scl), master(sda, scl), flash(), scl_status(scl), led_status(LED_STATUS)
+// Value returned for registers without data
+static const char i2c_read_default_value = I2C_READ_DEFAULT_VALUE;
+
+// Bus frequency of each bus mode
+static const int bus_mode_frequency[BUS_MODE_COUNT] = {I2C_FREQ, 400000, 1000000};
+
+#if I2C_FRAMEWORK_PEC
+// SMBus CRC-8 of each byte value, a lookup per byte so a PEC is cheap enough for the I2C interrupt
+static const uint8_t pec_table[256] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
+static uint8_t pec_update(uint8_t crc, const char *data, int size)
+{
+    for(int i = 0; i < size; i++){
+        crc = pec_table[crc ^ (uint8_t) data[i]];
+    }
+    return crc;
+}
+#endif
+
+I2C_Framework::I2C_Framework(PinName sda, PinName scl, PinName alert) : slave(sda, scl), master(sda, scl), flash(), metadata_store(flash, METADATA_LOG_ADDRESS, METADATA_LOG_PAGE_COUNT, sizeof(app_metadata_t)),
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    firmware_stager(flash, STAGING_ADDRESS, STAGING_SIZE, APPLICATION_ADDRESS - APPLICATION_HEADER_ADDRESS),
+#endif
+    scl_status(scl), sda_status(sda), led_status(LED_STATUS), alert_line(alert, PIN_OUTPUT, OpenDrain, 1), bus_sda(sda), bus_scl(scl)
 {
     // Set i2c register to 0
     i2c_register = 0;
 
-    // Set size of elements array to 0
-    i2c_callback_array_size = 0;
-
     // Get unique ID by unreference pointer
     id = *((uint32_t *)UNIQUE_ID_ADDR);
 
+    // Unique ID sent MSB first during address resolution, so arbitration keeps the lowest
+    for(int i = 0; i < 4; i++){
+        arp_uid[i] = id >> (24 - 8 * i);
+    }
+    address_assigned = false;
+    arp_start_time = 0;
+
     // Get access to application header in flash
     active_app_header = (app_header_t *)APPLICATION_HEADER_ADDRESS;
 
@@ -19,7 +63,94 @@ I2C_Framework::I2C_Framework(PinName sda, PinName scl) : slave(sda, scl), master
     active_app_metadata_flash = (app_metadata_t *)APPLICATION_METADATA_ADDRESS;
 
     // Clear buffer
-    memset(buffer, 0, 33);
+    memset(buffer, 0, I2C_RX_BUFFER_SIZE);
+    memset(map_tx_buffer, 0, I2C_REGISTER_MAP_MAX_DATA_SIZE);
+
+    // No transaction in progress
+    tx_data = nullptr;
+    tx_size = 0;
+    tx_index = 0;
+    tx_bank_register = -1;
+    prefetch_register = -1;
+    prefetch_data = nullptr;
+    prefetch_size = 0;
+    prefetch_time = 0;
+    rx_length = 0;
+    polled_rx_size = I2C_FRAMEWORK_FIRMWARE_STAGING ? I2C_RX_BUFFER_SIZE : I2C_POLLED_WRITE_SIZE;
+    rx_target = &buffer[1];
+    rx_target_size = I2C_BUFFER_SIZE - 1;
+    rx_general_call = false;
+#if I2C_FRAMEWORK_PEC
+    tx_pec = 0;
+    rx_dropped = 0;
+    rx_last_byte = 0;
+#endif
+    tx_stream = nullptr;
+    rx_stream = nullptr;
+    tx_stream_sequence = 0;
+    rx_stream_sequence = 0;
+    fifo = nullptr;
+    fifo_record_size = I2C_FIFO_TIMESTAMP_SIZE;
+    fifo_watermark = 1;
+    fifo_drain_count = 0xFF;
+    fifo_overflow = false;
+    bus_mode = BUS_MODE_STANDARD;
+    bus_mode_request = BUS_MODE_STANDARD;
+    bus_speed[0] = I2C_FRAMEWORK_MAX_BUS_MODE;
+    bus_speed[1] = BUS_MODE_STANDARD;
+    bus_speed[2] = 0;
+    for(int i = 0; i < SYNC_HOOK_COUNT; i++){
+        sync_hooks[i] = nullptr;
+        sync_hook_contexts[i] = nullptr;
+    }
+    time_offset = 0;
+    latch_time = 0;
+    latch_count = 0;
+    time_sync_count = 0;
+    memset(&power_stats, 0, sizeof(power_stats));
+    memset(&bus_health, 0, sizeof(bus_health));
+    bus_stuck_line = 0;
+    bus_stuck_start = 0;
+    bus_stuck_samples = 0;
+    bus_timeout_pending = false;
+    bus_recovery_failed = false;
+    error_latched = false;
+#if I2C_FRAMEWORK_LOW_POWER
+    power_state_start = 0;
+    power_run_us = 0;
+    power_stop_us = 0;
+    wake_pending = false;
+    wake_time = 0;
+#endif
+    alert_status = 0;
+    alert_mask = 0xFF;
+    alert_fifo_watermark = false;
+    alert_asserted = false;
+    alert_responded = false;
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    alert_response_pending = false;
+    alert_response = 0;
+#endif
+    tx_frame_ring = nullptr;
+    tx_frame_consume = 0;
+    metadata_commit_pending = 0;
+    metadata_change_time = 0;
+#if I2C_FRAMEWORK_STATS
+    memset(stats_histogram, 0, sizeof(stats_histogram));
+    stats_transfer_start = 0;
+#endif
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    tx_preloaded = false;
+#endif
+#if I2C_FRAMEWORK_DMA_MODE
+    rx_dma_active = false;
+    rx_dma_size = 0;
+    tx_dma_active = false;
+    tx_dma_size = 0;
+#endif
+
+    // Fill register table with built-in registers
+    init_register_table();
 }
 
 void I2C_Framework::init()
@@ -34,9 +165,41 @@ void I2C_Framework::init()
     rc = flash.read((char *) &active_app_metadata_ram, APPLICATION_METADATA_ADDRESS, sizeof(app_metadata_t));
     if(rc != 0){
         //printf("Error reading metadata from flash\r\n");
-        led_status = 1;
+        raise_error();
+    }
+
+    // Use latest metadata of the log if any, update flag stays the one read by the bootloader
+    uint32_t magic_firmware_need_update = active_app_metadata_ram.magic_firmware_need_update;
+    if(metadata_store.init() == 0 && metadata_store.load(&active_app_metadata_ram) == 0){
+        active_app_metadata_ram.magic_firmware_need_update = magic_firmware_need_update;
+
+        // Record of a firmware with other metadata fields, fields it lacks keep the values of the metadata page
+        if(metadata_store.needs_migration()){
+            request_metadata_save();
+        }
+    }
+
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    // Flag left set by a bootloader which does not install staged images, the old firmware still runs
+    if(active_app_metadata_ram.magic_firmware_need_update == MAGIC_FIRMWARE_STAGED){
+        const app_header_t *staged_header = (const app_header_t *) STAGING_ADDRESS;
+        if(memcmp(staged_header->firmware_version_hash, active_app_header->firmware_version_hash, 32) != 0){
+            //printf("Staged firmware not installed\r\n");
+            raise_error();
+        }
+        active_app_metadata_ram.magic_firmware_need_update = 0;
+        save_metadata_to_flash();
     }
 
+    // Resume a staged firmware download interrupted by a reset
+    firmware_stager.init();
+#endif
+
+#if I2C_FRAMEWORK_LOW_POWER
+    // Before setup_i2c(), bus timings depend on the I2C clock
+    setup_low_power();
+#endif
+
     // Setup i2c communication
     setup_i2c();
 
@@ -46,6 +209,10 @@ void I2C_Framework::init()
     watchdog->start(WATCHDOG_TIMEOUT);
 
     //printf("I2C Framework ready with I2C address 0x%x\n", slave_addr);
+
+#if I2C_FRAMEWORK_LOW_POWER
+    power_state_start = us_ticker_read();
+#endif
 }
 
 void I2C_Framework::check_scl(){
@@ -55,206 +222,1579 @@ void I2C_Framework::check_scl(){
     }
 }
 
+void I2C_Framework::check_bus(){
+    // SCL low, or SDA low while SCL is high, which no transfer does for long
+    uint8_t line = scl_status == 0 ? BUS_LINE_SCL : (sda_status == 0 ? BUS_LINE_SDA : 0);
+    uint32_t now = us_ticker_read();
+    if(line != bus_stuck_line){
+        bus_stuck_line = line;
+        bus_stuck_start = now;
+        bus_stuck_samples = 0;
+    }
+    bus_stuck_samples++;
+
+    // Lines released after a failed recovery, its error is withdrawn unless another one is latched
+    if(bus_recovery_failed && line == 0){
+        bus_recovery_failed = false;
+        if(!error_latched){
+            led_status = 0;
+            core_util_critical_section_enter();
+            alert_status &= ~ALERT_ERROR;
+            update_alert();
+            core_util_critical_section_exit();
+        }
+    }
+
+    // Several samples so a slow loop seeing the same level twice by chance is not a stuck bus
+    if(bus_timeout_pending || (line != 0 && bus_stuck_samples >= BUS_STUCK_MIN_SAMPLES && (now - bus_stuck_start) >= BUS_STUCK_TIMEOUT_MS * 1000)){
+        recover_bus(bus_timeout_pending ? 0 : line);
+    }
+}
+
+void I2C_Framework::recover_bus(uint8_t line){
+    uint32_t start = us_ticker_read();
+    if(line == BUS_LINE_SCL){
+        bus_health.scl_stuck_count++;
+    } else if(line == BUS_LINE_SDA){
+        bus_health.sda_stuck_count++;
+    }
+
+    // Peripheral stopped first, no interrupt runs on the dropped transaction
+    release_bus();
+    abort_transaction();
+    bus_timeout_pending = false;
+
+    // Back to the safest timing, this also resets the peripheral and takes it over again in interrupt mode
+    bus_mode_request = BUS_MODE_STANDARD;
+    set_bus_mode(BUS_MODE_STANDARD);
+
+    if(scl_status == 1 && sda_status == 1){
+        bus_health.recovery_count++;
+    } else {
+        // Line still held by another device, tried again after another timeout
+        bus_health.failed_recovery_count++;
+        bus_recovery_failed = true;
+        led_status = 1;
+        raise_alert(ALERT_ERROR);
+    }
+    uint32_t duration = us_ticker_read() - start;
+    bus_health.last_recovery_us = duration < 0xFFFF ? duration : 0xFFFF;
+
+    // Timeout restarts from the end of the recovery
+    bus_stuck_line = 0;
+}
+
 void I2C_Framework::loop_iteration()
 {
     // Check if SCL is stuck
     check_scl();
-    
+
+    // Recover a stuck bus before the watchdog resets the MCU
+    check_bus();
+
+    // Save metadata once the master stopped writing it
+    if(metadata_commit_pending && (us_ticker_read() - metadata_change_time) >= METADATA_COMMIT_DELAY_MS * 1000){
+        flush_metadata();
+    }
+
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    // Flash work of staged firmware commands
+    if(firmware_stager.is_busy()){
+        suspend_bus_timeout();
+        firmware_stager.process();
+        resume_bus_timeout();
+    }
+    if(firmware_stager.is_install_requested()){
+        install_staged_firmware();
+    }
+#endif
+
+    // Bus speed changed by a general call or a bus error
+    if(bus_mode_request != bus_mode){
+        set_bus_mode(bus_mode_request);
+    }
+
+    // Signal pending conditions on ALERT#
+    update_alert();
+
+    // No master assigned an address in time, find one alone
+    if(!address_assigned && (us_ticker_read() - arp_start_time) >= ARP_TIMEOUT_MS * 1000){
+        probe_i2c_address();
+    }
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    // Transactions are served from the I2C interrupt once the address is assigned
+    if(address_assigned){
+        return;
+    }
+#endif
+
+    poll_slave();
+}
+
+void I2C_Framework::poll_slave()
+{
     // Check if i2c slave has been addressed
     slave_action = slave.receive();
-    
+
+    // General call reported as an addressed write by some targets
+    if(slave_action == I2CSlave::WriteAddressed && is_general_call()){
+        slave_action = I2CSlave::WriteGeneral;
+    }
+
     switch (slave_action) {
-        case I2CSlave::ReadAddressed:
+        case I2CSlave::ReadAddressed: {
             
             //printf("i2c_register : 0x%x\n", i2c_register);
 
-            for(int i = 0; i < i2c_callback_array_size; i++){
-                if(i2c_callback_array[i][0] == i2c_register){
-                    // Get read callback from array
-                    char * (*read_callback)() = (char * (*)()) i2c_callback_array[i][1];
-                    // Call read callback
-                    char *data = read_callback();
-                    // Write data to i2c slave
-                    slave.write(data, i2c_callback_array[i][3]);
-                    // Set register to 0
-                    i2c_register = 0;
-                    return;
-                }
+            // Get data of register from table and write it to i2c slave
+            uint8_t reg = i2c_register;
+            int size;
+            const char *data = take_read_data(&size);
+#if I2C_FRAMEWORK_PEC
+            // PEC sent right after the data, from the frame buffer, so a longer read is cut to fit it
+            if(size > I2C_STREAM_FRAME_SIZE){
+                size = I2C_STREAM_FRAME_SIZE;
             }
-            
+            memmove(tx_frame, data, size);
+            tx_frame[size] = compute_pec(get_own_address() << 1 | 1, nullptr, 0, tx_frame, size);
+            data = tx_frame;
+            int data_size = size++;
+#else
+            int data_size = size;
+#endif
+            STATS_START(transfer_start);
+            rc = slave.write(data, size);
+            STATS_STOP(STATS_TRANSFER, transfer_start);
+            end_frame_read(rc == 0);
+            end_register_read();
 
-            switch (i2c_register){
-                case UID_REG: // Write Unique ID
-                    slave.write((char *) &id, 4);
-                    break;
-
-                case VERSION_HASH_REG: // Write major version of firmware
-                    slave.write((char*) active_app_header->firmware_version_hash, 32);
-                    break;
-                
-                case GROUP_REG: // Write group of sensor
-                    slave.write(active_app_metadata_ram.group);
-                    break;
-
-                case SENSOR_TYPE_REG: // Write sensor type
-                    slave.write((char*) active_app_metadata_ram.sensor_type, 32);
-                    break;
-                
-                case NAME_REG: // Write name of sensor
-                    slave.write((char*) active_app_metadata_ram.name, 32);
-                    break;
-
-                default: // Register not set with write before, return default value
-                    //printf("Default value, 0x%x\n", I2C_READ_DEFAULT_VALUE);
-                    int data = I2C_READ_DEFAULT_VALUE;
-                    slave.write(data);
-                    break;
+            // Bytes read are unknown when the master stopped early, the pointer then stays
+            if(get_register_entry(reg)->bank_size > 0){
+                advance_bank_pointer(reg, rc == 0 ? data_size : 0);
             }
 
-            i2c_register = 0;
-
             break;
+        }
+
+        case I2CSlave::WriteGeneral: {
+            rc = slave.read(buffer, polled_rx_size);
+            rx_length = polled_rx_size;
+            rx_general_call = true;
+
+#if I2C_FRAMEWORK_PEC
+            // Corrupted command, drop it
+            if(check_polled_write_pec()){
+                process_general_call(buffer);
+            }
+#else
+            process_general_call(buffer);
+#endif
 
-        case I2CSlave::WriteGeneral:
-            // Do nothing
+            // Clear buffer
+            memset(buffer, 0, I2C_RX_BUFFER_SIZE);
+            rx_length = 0;
+            rx_general_call = false;
             break;
+        }
 
-        case I2CSlave::WriteAddressed:
-            rc = slave.read(buffer, 33);
+        case I2CSlave::WriteAddressed: {
+            STATS_START(transfer_start);
+            rc = slave.read(buffer, polled_rx_size);
+            STATS_STOP(STATS_TRANSFER, transfer_start);
 
-            //printf("Register : 0x%x\n", buffer[0]);
+            // Number of bytes is unknown when polling, handlers get the whole buffer
+            rx_length = polled_rx_size;
 
-            // Set register for next read
-            i2c_register = buffer[0];
-
-            switch (buffer[0]){
-                case GROUP_REG: // If new group is received, save to flash
-                    if(buffer[1] > 0){
-                        active_app_metadata_ram.group = buffer[1];
-                        save_metadata_to_flash();
-                        i2c_register = 0;
-                    }
-                    break;
-
-                case FIRMWARE_REG: // If it's firmware register, set flag to update firmware and restart MCU
-                    active_app_metadata_ram.magic_firmware_need_update = MAGIC_FIRMWARE_NEED_UPDATE;
-                    save_metadata_to_flash();
-                    // Restart MCU to update firmware from bootloader
-                    NVIC_SystemReset();
-                    break;
-
-                case SENSOR_TYPE_REG: // If new sensor type is received, save to flash
-                    if(buffer[1] > 0){
-                        memcpy(&active_app_metadata_ram.sensor_type, &buffer[1], 32);
-                        save_metadata_to_flash();
-                        i2c_register = 0;
-                    }
-                    break;
-
-                case NAME_REG: // If new name is received, save to flash
-                    if(buffer[1] > 0){
-                        memcpy(&active_app_metadata_ram.name, &buffer[1], 32);
-                        save_metadata_to_flash();
-                        i2c_register = 0;
-                    }
-                    break;
-
-                default:
-                    break;
+#if I2C_FRAMEWORK_PEC
+            // Corrupted write, drop it before any handler runs
+            if(!check_polled_write_pec()){
+                memset(buffer, 0, I2C_RX_BUFFER_SIZE);
+                rx_length = 0;
+                break;
             }
+#endif
 
-            
-            for(int i = 0; i < i2c_callback_array_size; i++){
-                if(i2c_callback_array[i][0] == i2c_register){
-                    // Get write callback from array
-                    int (*write_callback)(char *) = (int (*)(char *)) i2c_callback_array[i][2];
-                    // Call write callback
-                    i2c_register = write_callback(buffer);
-                }
+            //printf("Register : 0x%x\n", buffer[0]);
+
+            // Register with its own buffer, move data to it
+            rx_target = get_write_target(buffer[0], &rx_target_size);
+            if(rx_target != &buffer[1]){
+                memcpy(rx_target, &buffer[1], rx_target_size < I2C_RX_BUFFER_SIZE - 1 ? rx_target_size : I2C_RX_BUFFER_SIZE - 1);
             }
 
+            process_write(buffer);
+
             // Clear buffer
-            memset(buffer, 0, 33);
+            memset(buffer, 0, I2C_RX_BUFFER_SIZE);
+            rx_length = 0;
             
             break;
+        }
     }
-    
 }
 
-void I2C_Framework::save_metadata_to_flash()
+const char *I2C_Framework::get_read_data(uint8_t reg, int *size)
 {
-    // Erase sector on metadata address
-    rc = flash.erase(APPLICATION_METADATA_ADDRESS, 2048);
-    if(rc != 0){
-        //printf("Erase metadata from flash failed\n");
-        led_status = 1;
+    // Address resolution, send unique ID
+    if(!address_assigned){
+        *size = 4;
+        return arp_uid;
     }
-    // Set metadata from RAM to flash
-    rc = flash.program((char *) &active_app_metadata_ram, APPLICATION_METADATA_ADDRESS, sizeof(app_metadata_t));
-    if(rc != 0){
-        //printf("Error writing metadata from flash\r\n");
-        led_status = 1;
+
+    STATS_START(dispatch_start);
+    i2c_register_entry_t *entry = get_register_entry(reg);
+
+    *size = entry->data_size;
+    STATS_STOP(STATS_DISPATCH, dispatch_start);
+
+    // User callback has priority over built-in data
+    if(entry->read_callback != nullptr){
+        STATS_START(callback_start);
+        char *data = entry->read_callback();
+        STATS_STOP(STATS_CALLBACK, callback_start);
+        return data;
     }
-    // Copy metadata from flash to RAM
-    rc = flash.read((char *) &active_app_metadata_ram, APPLICATION_METADATA_ADDRESS, sizeof(app_metadata_t));
-    if(rc != 0){
-        //printf("Error reading metadata from flash\r\n");
-        led_status = 1;
+
+    // Register map handler fills the framework buffer
+    if(entry->map_read != nullptr){
+        STATS_START(callback_start);
+        i2c_span_t data = {map_tx_buffer, entry->data_size};
+        int length = entry->map_read(entry->map_context, data);
+        STATS_STOP(STATS_CALLBACK, callback_start);
+        *size = length < 0 ? 0 : (length > entry->data_size ? entry->data_size : length);
+        return map_tx_buffer;
+    }
+
+    // Latest published snapshot, kept unchanged until the next read
+    if(entry->snapshot != nullptr){
+        *size = entry->snapshot->get_size();
+        return entry->snapshot->acquire();
+    }
+
+    // Built-in data built at read time
+    if(entry->builtin_read != nullptr){
+        return (this->*entry->builtin_read)(size);
     }
+
+    // Register bank, from the register to the end of the bank
+    if(entry->bank_size > 0){
+        int offset = reg - entry->bank_first;
+        *size = entry->data_size - offset;
+        return entry->read_data + offset;
+    }
+
+    return entry->read_data;
 }
 
-void I2C_Framework::setup_i2c()
+const char *I2C_Framework::take_read_data(int *size)
 {
-    // Generate a random slave address with unique ID
-    slave_addr = (id) % 95 + 0x10;
+    // Resolved when the register was selected, used once
+    bool prefetched = prefetch_register == i2c_register && (us_ticker_read() - prefetch_time) < I2C_PREFETCH_MAX_AGE_US;
+    prefetch_register = -1;
+    if(prefetched && address_assigned){
+        *size = prefetch_size;
+        return prefetch_data;
+    }
+    return get_read_data(i2c_register, size);
+}
 
-    // Generate a random wait time with unique ID
-    uint16_t wait_time = (id) % 1000;
+void I2C_Framework::prefetch_read(uint8_t reg)
+{
+    i2c_register_entry_t *entry = get_register_entry(reg);
+    prefetch_register = -1;
 
-    // Set slave address to 0x00 to disable slave for now
-    slave.address(0);
-    slave.frequency(I2C_FREQ);
+    // Data built at read time, or a read with side effects, waits for the read
+    if(!address_assigned || !entry->prefetch || entry->builtin_read != nullptr){
+        return;
+    }
 
-    // Wait for a random time to avoid collision
-    HAL_Delay(wait_time);
+    prefetch_data = get_read_data(reg, &prefetch_size);
+    prefetch_time = us_ticker_read();
+    prefetch_register = reg;
+}
 
-    master.frequency(I2C_FREQ);
+void I2C_Framework::process_write(char *buffer)
+{
+    // Address resolution, only assignment is accepted
+    if(!address_assigned){
+        process_arp_write(buffer);
+        return;
+    }
 
-    // Create a buffer to store data
-    char data[1];
+    STATS_START(dispatch_start);
 
-    // Check if slave address is already in use
-    do{
-        rc = master.read(slave_addr << 1, data, 1, false);
+    // Set register for next read
+    i2c_register = buffer[0];
 
-        if(rc != 0){
-            // If slave address is free, set slave address
-            slave.address(slave_addr << 1);
-        } else {
-            // If slave address is not free
-            if(slave_addr == 0x6F){
-                // If slave address is too high, reset to 0x10
-                slave_addr = 0x10;
-            } else {
-                slave_addr++;
-            }
+    // Built-in register, may reset register to 0
+    if(get_register_entry(i2c_register)->builtin_write != nullptr){
+        (this->*get_register_entry(i2c_register)->builtin_write)(buffer);
+    }
+
+    i2c_register_entry_t *entry = get_register_entry(i2c_register);
+    STATS_STOP(STATS_DISPATCH, dispatch_start);
+
+    // User callback, return the register for next read
+    if(entry->write_callback != nullptr){
+        STATS_START(callback_start);
+        i2c_register = entry->write_callback(entry->write_buffer != nullptr ? entry->write_buffer : buffer);
+        STATS_STOP(STATS_CALLBACK, callback_start);
+    }
+
+    // Register map handler gets the data following the register byte, return the register for next read
+    if(entry->map_write != nullptr){
+        STATS_START(callback_start);
+        int length = rx_length - 1 < rx_target_size ? rx_length - 1 : rx_target_size;
+        i2c_span_t data = {rx_target, length > 0 ? length : 0};
+        i2c_register = entry->map_write(entry->map_context, data);
+        STATS_STOP(STATS_CALLBACK, callback_start);
+    }
+
+    // Resolved on the register byte, again only if data written may change it or the handler selected another register
+    if(rx_length > 1 || prefetch_register != i2c_register){
+        prefetch_read(i2c_register);
+    }
+}
+
+char *I2C_Framework::get_write_target(uint8_t reg, int *size)
+{
+    i2c_register_entry_t *entry = get_register_entry(reg);
+
+    // Built-in registers, general call and address resolution always use the shared buffer
+    if(entry->write_buffer == nullptr || entry->builtin_write != nullptr || rx_general_call || !address_assigned){
+        // Stream frames, firmware chunks and group writes are larger than other writes
+        *size = reg == STREAM_REG || reg == FIRMWARE_STAGE_REG || entry->bank_size > 0 || rx_general_call ? I2C_RX_BUFFER_SIZE - 1 : I2C_BUFFER_SIZE - 1;
+        return &buffer[1];
+    }
+
+    *size = entry->write_buffer_size;
+    return entry->write_buffer;
+}
+
+void I2C_Framework::request_metadata_save()
+{
+    // Writes close to each other end up in a single flash commit
+    metadata_change_time = us_ticker_read();
+    metadata_commit_pending = 1;
+}
+
+void I2C_Framework::flush_metadata()
+{
+    if(metadata_commit_pending){
+        // Cleared first, a write during the commit makes it pending again
+        metadata_commit_pending = 0;
+        STATS_START(commit_start);
+        save_metadata_to_flash();
+        STATS_STOP(STATS_FLASH_COMMIT, commit_start);
+    }
+}
+
+void I2C_Framework::on_address_match(bool transmit, bool general_call)
+{
+#if I2C_FRAMEWORK_STATS
+    // Transfer lasts from address match to stop
+    stats_transfer_start = us_ticker_read();
+#endif
+
+#if I2C_FRAMEWORK_LOW_POWER
+    // First transaction after Stop mode
+    if(wake_pending){
+        uint32_t latency = us_ticker_read() - wake_time;
+        power_stats.last_wake_latency_us = latency < 0xFFFF ? latency : 0xFFFF;
+        if(power_stats.last_wake_latency_us > power_stats.max_wake_latency_us){
+            power_stats.max_wake_latency_us = power_stats.last_wake_latency_us;
         }
-    
-    // Loop until slave address is busy
-    } while (rc == 0);
+        wake_pending = false;
+    }
+#endif
+
+    // Repeated start, the write before it selects the register read now
+    end_write();
+
+    if(transmit){
+        // Resolve data of register before the first byte is requested
+        tx_bank_register = address_assigned && get_register_entry(i2c_register)->bank_size > 0 ? i2c_register : -1;
+        tx_data = take_read_data(&tx_size);
+        tx_index = 0;
+#if I2C_FRAMEWORK_PEC
+        tx_pec = compute_pec(get_own_address() << 1 | 1, nullptr, 0, tx_data, tx_size);
+#endif
+        end_register_read();
+    } else {
+        rx_length = 0;
+        rx_general_call = general_call;
+#if I2C_FRAMEWORK_PEC
+        rx_dropped = 0;
+#endif
+    }
 }
 
-void I2C_Framework::init_i2c_callback_size(int size){
-    i2c_callback_array = new uint32_t*[size];
-    for(int i = 0; i < size; i++){
-        i2c_callback_array[i] = new uint32_t[4];
+void I2C_Framework::on_receive_byte(uint8_t data)
+{
+    if(rx_length == 0){
+        // First byte is the register, it selects where the data goes
+        buffer[0] = data;
+        rx_target = get_write_target(data, &rx_target_size);
+
+        // Read data resolved while the master sends the rest, ready at the repeated start
+        if(!rx_general_call){
+            prefetch_read(data);
+        }
+    } else if(rx_length - 1 < rx_target_size){
+        rx_target[rx_length - 1] = data;
+    } else {
+        // Buffer full, drop data
+#if I2C_FRAMEWORK_PEC
+        // Kept in case it is the PEC
+        rx_last_byte = data;
+        rx_dropped++;
+#endif
+        return;
     }
+    rx_length++;
 }
 
-void I2C_Framework::add_i2c_callback(int register_address, char * (*read_callback)(), int (*write_callback)(char *buffer), int data_size){
-    i2c_callback_array[i2c_callback_array_size][0] = register_address;
-    i2c_callback_array[i2c_callback_array_size][1] = reinterpret_cast<uint32_t>(read_callback);
-    i2c_callback_array[i2c_callback_array_size][2] = reinterpret_cast<uint32_t>(write_callback);
-    i2c_callback_array[i2c_callback_array_size][3] = data_size;
-    i2c_callback_array_size++;
-}
\ No newline at end of file
+uint8_t I2C_Framework::on_transmit_byte()
+{
+#if I2C_FRAMEWORK_PEC
+    // PEC follows the data
+    if(tx_index == tx_size){
+        tx_index++;
+        return tx_pec;
+    }
+#endif
+
+    // Master reads past the end of the data, send default value
+    if(tx_index >= tx_size){
+        return I2C_READ_DEFAULT_VALUE;
+    }
+    return tx_data[tx_index++];
+}
+
+void I2C_Framework::end_write()
+{
+    if(rx_length == 0){
+        return;
+    }
+
+#if I2C_FRAMEWORK_PEC
+    // Corrupted write, drop it before any handler runs
+    bool valid = check_write_pec();
+#else
+    bool valid = true;
+#endif
+
+    if(valid && rx_general_call){
+        process_general_call(buffer);
+    } else if(valid){
+        process_write(buffer);
+    }
+
+    // Clear received bytes, the rest of the shared buffer is still cleared
+    memset(buffer, 0, rx_target == &buffer[1] ? rx_length : 1);
+    rx_length = 0;
+}
+
+void I2C_Framework::on_stop()
+{
+#if I2C_FRAMEWORK_STATS
+    stats_record(STATS_TRANSFER, us_ticker_read() - stats_transfer_start);
+#endif
+
+    end_write();
+    end_frame_read(tx_data != nullptr && tx_index >= tx_size);
+
+    // Bank pointer moves past the bytes the master read
+    if(tx_bank_register >= 0){
+        advance_bank_pointer(tx_bank_register, tx_index < tx_size ? tx_index : tx_size);
+        tx_bank_register = -1;
+    }
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    // Alert response sent without losing arbitration, release ALERT# until a new source is raised
+    if(alert_response_pending){
+        alert_response_pending = false;
+        alert_responded = true;
+        update_alert();
+    }
+#endif
+
+    tx_data = nullptr;
+    tx_size = 0;
+}
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+void I2C_Framework::on_alert_response()
+{
+    // Own address, the lowest one wins arbitration
+    alert_response = slave_addr << 1;
+    tx_data = &alert_response;
+    tx_size = 1;
+    tx_index = 0;
+#if I2C_FRAMEWORK_PEC
+    tx_pec = compute_pec(ALERT_RESPONSE_ADDRESS << 1 | 1, nullptr, 0, tx_data, tx_size);
+#endif
+    alert_response_pending = true;
+}
+#endif
+
+void I2C_Framework::on_bus_error()
+{
+    bus_health.bus_error_count++;
+
+    // Back to the safest timing
+    bus_mode_request = BUS_MODE_STANDARD;
+    abort_transaction();
+}
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+void I2C_Framework::on_bus_timeout()
+{
+    // SCL held low too long, lines are released from the main loop
+    bus_health.timeout_count++;
+    bus_timeout_pending = true;
+    abort_transaction();
+}
+
+void I2C_Framework::on_arbitration_lost()
+{
+    // Another alerting node sent a lower address, keep ALERT# asserted and the bus timing, the master reads again
+    if(alert_response_pending){
+        abort_transaction();
+        return;
+    }
+    on_bus_error();
+}
+#endif
+
+void I2C_Framework::abort_transaction()
+{
+    // Drop partial data, frame is sent again
+    memset(buffer, 0, I2C_RX_BUFFER_SIZE);
+    end_frame_read(false);
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    // Alert response lost arbitration, keep ALERT# asserted
+    alert_response_pending = false;
+#endif
+    rx_length = 0;
+    rx_target = &buffer[1];
+    tx_data = nullptr;
+    tx_size = 0;
+    tx_bank_register = -1;
+}
+
+#if I2C_FRAMEWORK_STATS
+void I2C_Framework::stats_record(int phase, uint32_t duration)
+{
+    // Bucket i counts durations below 4^i us
+    int bucket = 0;
+    while(bucket < STATS_BUCKET_COUNT - 1 && duration >= (1UL << (2 * bucket))){
+        bucket++;
+    }
+
+    // Saturate instead of wrapping
+    if(stats_histogram[phase][bucket] < 0xFFFF){
+        stats_histogram[phase][bucket]++;
+    }
+}
+#endif
+
+void I2C_Framework::write_firmware_reg(char *buffer)
+{
+    (void) buffer;
+    // Set flag to update firmware and restart MCU, pending metadata changes are saved with it
+    active_app_metadata_ram.magic_firmware_need_update = MAGIC_FIRMWARE_NEED_UPDATE;
+    metadata_commit_pending = 0;
+    save_metadata_to_flash();
+    // Restart MCU to update firmware from bootloader
+    NVIC_SystemReset();
+}
+
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+void I2C_Framework::install_staged_firmware()
+{
+    // Bootloader copies the verified staged image instead of waiting for one over the bus
+    active_app_metadata_ram.magic_firmware_need_update = MAGIC_FIRMWARE_STAGED;
+    metadata_commit_pending = 0;
+    save_metadata_to_flash();
+    NVIC_SystemReset();
+}
+#endif
+
+void I2C_Framework::write_group_reg(char *buffer)
+{
+    // If new group is received, save to flash
+    if(buffer[1] > 0){
+        active_app_metadata_ram.group = buffer[1];
+        request_metadata_save();
+        i2c_register = 0;
+    }
+}
+
+void I2C_Framework::write_sensor_type_reg(char *buffer)
+{
+    // If new sensor type is received, save to flash
+    if(buffer[1] > 0){
+        memcpy(&active_app_metadata_ram.sensor_type, &buffer[1], 32);
+        request_metadata_save();
+        i2c_register = 0;
+    }
+}
+
+void I2C_Framework::write_name_reg(char *buffer)
+{
+    // If new name is received, save to flash
+    if(buffer[1] > 0){
+        memcpy(&active_app_metadata_ram.name, &buffer[1], 32);
+        request_metadata_save();
+        i2c_register = 0;
+    }
+}
+
+void I2C_Framework::write_stream_reg(char *buffer)
+{
+    uint16_t length = (uint8_t) buffer[1] | (uint8_t) buffer[2] << 8;
+    uint16_t sequence = (uint8_t) buffer[3] | (uint8_t) buffer[4] << 8;
+
+    // Register alone, or truncated frame
+    if(length == 0 || length > I2C_STREAM_CHUNK_SIZE || I2C_STREAM_HEADER_SIZE + length > rx_length - 1){
+        return;
+    }
+
+    // Frame already received or lost before, master reads the expected sequence from STREAM_STATUS_REG
+    if(sequence != rx_stream_sequence){
+        return;
+    }
+
+    // Flow control, frame is dropped until the application made room for it
+    if(rx_stream == nullptr || rx_stream->space() < length){
+        return;
+    }
+
+    rx_stream->write(&buffer[1 + I2C_STREAM_HEADER_SIZE], length);
+    rx_stream_sequence++;
+}
+
+const char *I2C_Framework::read_stream_reg(int *size)
+{
+    int length = 0;
+    if(tx_stream != nullptr){
+        length = tx_stream->peek(&tx_frame[I2C_STREAM_HEADER_SIZE], I2C_STREAM_CHUNK_SIZE);
+    }
+
+    tx_frame[0] = length;
+    tx_frame[1] = length >> 8;
+    tx_frame[2] = tx_stream_sequence;
+    tx_frame[3] = tx_stream_sequence >> 8;
+
+    // Data stays in the stream until the whole frame is sent
+    tx_frame_ring = tx_stream;
+    tx_frame_consume = length;
+
+    *size = I2C_STREAM_HEADER_SIZE + length;
+    return tx_frame;
+}
+
+const char *I2C_Framework::read_stream_status_reg(int *size)
+{
+    uint16_t status[4];
+    status[0] = tx_stream != nullptr ? tx_stream->available() : 0;
+    status[1] = rx_stream != nullptr ? rx_stream->space() : 0;
+    status[2] = tx_stream_sequence;
+    status[3] = rx_stream_sequence;
+
+    for(int i = 0; i < 4; i++){
+        tx_frame[2 * i] = status[i];
+        tx_frame[2 * i + 1] = status[i] >> 8;
+    }
+
+    *size = I2C_STREAM_STATUS_SIZE;
+    return tx_frame;
+}
+
+void I2C_Framework::write_fifo_watermark_reg(char *buffer)
+{
+    // If new watermark is received, else register alone selects it for a read
+    uint16_t watermark = (uint8_t) buffer[1] | (uint8_t) buffer[2] << 8;
+    if(watermark > 0){
+        fifo_watermark = watermark;
+        i2c_register = 0;
+    }
+}
+
+void I2C_Framework::write_fifo_drain_reg(char *buffer)
+{
+    // If new count is received, else register alone keeps the previous one
+    if(buffer[1] != 0){
+        fifo_drain_count = buffer[1];
+    }
+}
+
+const char *I2C_Framework::read_fifo_level_reg(int *size)
+{
+    uint16_t level = fifo != nullptr ? fifo->available() / fifo_record_size : 0;
+
+    uint8_t flags = 0;
+    if(level >= fifo_watermark){
+        flags |= FIFO_FLAG_WATERMARK;
+    }
+    if(fifo_overflow){
+        flags |= FIFO_FLAG_OVERFLOW;
+    }
+
+    tx_frame[0] = level;
+    tx_frame[1] = level >> 8;
+    tx_frame[2] = flags;
+    tx_frame[3] = fifo_record_size;
+
+    *size = I2C_FIFO_LEVEL_SIZE;
+    return tx_frame;
+}
+
+const char *I2C_Framework::read_fifo_drain_reg(int *size)
+{
+    // Whole records only, as many as asked and as fit in a frame
+    int count = 0;
+    if(fifo != nullptr){
+        count = (I2C_STREAM_FRAME_SIZE - 1) / fifo_record_size;
+        if(fifo_drain_count < count){
+            count = fifo_drain_count;
+        }
+        count = fifo->peek(&tx_frame[1], count * fifo_record_size) / fifo_record_size;
+    }
+    tx_frame[0] = count;
+
+    // Records stay in the FIFO until the whole frame is sent
+    tx_frame_ring = fifo;
+    tx_frame_consume = count * fifo_record_size;
+
+    *size = 1 + count * fifo_record_size;
+    return tx_frame;
+}
+
+const char *I2C_Framework::read_alert_status_reg(int *size)
+{
+    // Sources sent are cleared, the master serves them
+    core_util_critical_section_enter();
+    uint8_t status = alert_status;
+    alert_status &= ~status;
+    update_alert();
+    core_util_critical_section_exit();
+    tx_frame[0] = status;
+
+    *size = 1;
+    return tx_frame;
+}
+
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+void I2C_Framework::write_firmware_stage_reg(char *buffer)
+{
+    // Register alone selects the status for a read
+    if(rx_length > 1){
+        firmware_stager.write_command(&buffer[1], rx_length - 1);
+    }
+}
+
+const char *I2C_Framework::read_firmware_stage_reg(int *size)
+{
+    firmware_stager.get_status(tx_frame);
+
+    *size = FIRMWARE_STAGE_STATUS_SIZE;
+    return tx_frame;
+}
+#endif
+
+void I2C_Framework::write_register_bank(char *buffer)
+{
+    uint8_t reg = buffer[0];
+    i2c_register_entry_t *entry = get_register_entry(reg);
+    int offset = reg - entry->bank_first;
+
+    // Writable banks need interrupt mode, the length received is the one sent
+    int length = rx_length - 1;
+
+    // Data past the end of the bank is dropped
+    if(length > entry->data_size - offset){
+        length = entry->data_size - offset;
+    }
+    if(length > 0){
+        memcpy((char *) entry->read_data + offset, &buffer[1], length);
+    }
+    advance_bank_pointer(reg, length);
+}
+
+void I2C_Framework::advance_bank_pointer(uint8_t reg, int count)
+{
+    i2c_register_entry_t *entry = get_register_entry(reg);
+    i2c_register = entry->bank_first + (reg - entry->bank_first + count) % entry->bank_size;
+}
+
+const char *I2C_Framework::read_sync_reg(int *size)
+{
+    uint32_t latch = latch_time + time_offset;
+    for(int i = 0; i < 4; i++){
+        tx_frame[i] = latch >> (8 * i);
+    }
+    tx_frame[4] = latch_count;
+    tx_frame[5] = latch_count >> 8;
+    tx_frame[6] = time_sync_count;
+    tx_frame[7] = time_sync_count >> 8;
+
+    *size = SYNC_STATUS_SIZE;
+    return tx_frame;
+}
+
+int I2C_Framework::get_write_size(char *buffer)
+{
+    // General call, command then its arguments
+    if(rx_general_call){
+        switch((uint8_t) buffer[0]){
+            case GENERAL_CALL_BUS_MODE_CMD:
+                return 1;
+            case GENERAL_CALL_GROUP_WRITE_CMD:
+                return 2 + get_register_write_size(&buffer[2]);
+            case GENERAL_CALL_TIME_SYNC_CMD:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    // Address resolution, only assignment is accepted
+    if(!address_assigned){
+        return 5;
+    }
+
+    return get_register_write_size(buffer);
+}
+
+int I2C_Framework::get_register_write_size(char *buffer)
+{
+    // Stream frame header gives the frame length
+    if((uint8_t) buffer[0] == STREAM_REG){
+        int length = (uint8_t) buffer[1] | (uint8_t) buffer[2] << 8;
+        return I2C_STREAM_HEADER_SIZE + (length < I2C_STREAM_CHUNK_SIZE ? length : I2C_STREAM_CHUNK_SIZE);
+    }
+
+    // Firmware stage command gives its own length
+    if((uint8_t) buffer[0] == FIRMWARE_STAGE_REG){
+        return FirmwareStager::get_command_size(&buffer[1]);
+    }
+
+    // Writable bank, up to its end
+    i2c_register_entry_t *entry = get_register_entry(buffer[0]);
+    if(entry->bank_size > 0 && entry->write_size > 0){
+        return entry->write_size - ((uint8_t) buffer[0] - entry->bank_first);
+    }
+
+    return entry->write_size;
+}
+
+#if I2C_FRAMEWORK_PEC
+uint8_t I2C_Framework::compute_pec(uint8_t address_byte, const char *header, int header_size, const char *data, int size)
+{
+    uint8_t crc = pec_table[address_byte];
+    crc = pec_update(crc, header, header_size);
+    crc = pec_update(crc, data, size);
+    return crc;
+}
+
+bool I2C_Framework::check_write_pec()
+{
+    // Register, data then PEC, at most the PEC does not fit in the target
+    if(rx_length + rx_dropped < 2 || rx_dropped > 1){
+        return false;
+    }
+
+    int size;
+    uint8_t pec;
+    if(rx_dropped == 1){
+        size = rx_length - 1;
+        pec = rx_last_byte;
+    } else {
+        size = rx_length - 2;
+        pec = rx_target[size];
+    }
+
+    uint8_t address_byte = rx_general_call ? 0 : get_own_address() << 1;
+    if(compute_pec(address_byte, buffer, 1, rx_target, size) != pec){
+        return false;
+    }
+
+    // Handlers only see the data
+    if(rx_dropped == 0){
+        rx_target[size] = 0;
+    }
+    rx_length = 1 + size;
+    return true;
+}
+
+bool I2C_Framework::check_polled_write_pec()
+{
+    uint8_t address_byte = rx_general_call ? 0 : get_own_address() << 1;
+
+    // Register selection, the rest of the buffer is still cleared
+    // Checked first, a PEC followed by zeros also passes the check of a whole write
+    bool cleared = true;
+    for(int i = 2; i < I2C_RX_BUFFER_SIZE; i++){
+        if(buffer[i] != 0){
+            cleared = false;
+            break;
+        }
+    }
+    if(cleared && compute_pec(address_byte, buffer, 1, nullptr, 0) == (uint8_t) buffer[1]){
+        buffer[1] = 0;
+        rx_length = 1;
+        return true;
+    }
+
+    // Whole write of the register
+    int size = get_write_size(buffer);
+    if(size > polled_rx_size - 2){
+        size = polled_rx_size - 2;
+    }
+    if(compute_pec(address_byte, buffer, 1, &buffer[1], size) == (uint8_t) buffer[1 + size]){
+        buffer[1 + size] = 0;
+        rx_length = 1 + size;
+        return true;
+    }
+
+    return false;
+}
+
+uint8_t I2C_Framework::get_own_address()
+{
+    return address_assigned ? slave_addr : ARP_ADDRESS;
+}
+#endif
+
+void I2C_Framework::update_alert()
+{
+    // Status, response state and OAR2 are also changed from the I2C interrupt
+    core_util_critical_section_enter();
+
+    // Watermark latched when the FIFO reaches it
+    bool watermark = fifo != nullptr && fifo->available() / fifo_record_size >= fifo_watermark;
+    if(watermark && !alert_fifo_watermark){
+        alert_status |= ALERT_FIFO_WATERMARK;
+        alert_responded = false;
+    }
+    alert_fifo_watermark = watermark;
+
+    // Open drain, pulled low while an enabled source is pending and no alert response released it
+    bool active = address_assigned && (alert_status & alert_mask) != 0 && !alert_responded;
+    if(active != alert_asserted){
+        alert_asserted = active;
+
+        if(alert_line.is_connected()){
+            alert_line = active ? 0 : 1;
+        }
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+        set_alert_response(active);
+#endif
+    }
+
+    core_util_critical_section_exit();
+}
+
+void I2C_Framework::end_frame_read(bool complete)
+{
+    if(tx_frame_ring == nullptr){
+        return;
+    }
+
+    // Frame read by the master, next read gets the next data
+    if(complete && tx_frame_consume > 0){
+        tx_frame_ring->skip(tx_frame_consume);
+        if(tx_frame_ring == tx_stream){
+            tx_stream_sequence++;
+        }
+        if(tx_frame_ring == fifo){
+            fifo_overflow = false;
+        }
+    }
+    tx_frame_ring = nullptr;
+}
+
+void I2C_Framework::end_register_read()
+{
+    if(i2c_register != STREAM_REG && i2c_register != FIFO_DRAIN_REG && get_register_entry(i2c_register)->bank_size == 0){
+        i2c_register = 0;
+    }
+}
+
+void I2C_Framework::save_metadata_to_flash()
+{
+    // Register writes can change the RAM copy from the interrupt, program a consistent snapshot
+    app_metadata_t metadata;
+    core_util_critical_section_enter();
+    metadata = active_app_metadata_ram;
+    core_util_critical_section_exit();
+
+    suspend_bus_timeout();
+
+    // Append metadata to the log, no erase until a log page is full
+    rc = metadata_store.save(&metadata);
+    if(rc != 0){
+        //printf("Error writing metadata to log\r\n");
+        raise_error();
+    }
+
+    // Metadata page is read by the bootloader, rewrite it only when the update flag changes
+    if(metadata.magic_firmware_need_update != active_app_metadata_flash->magic_firmware_need_update){
+        // Erase sector on metadata address
+        rc = flash.erase(APPLICATION_METADATA_ADDRESS, 2048);
+        if(rc != 0){
+            //printf("Erase metadata from flash failed\n");
+            raise_error();
+        }
+        // Set metadata from RAM to flash
+        rc = flash.program((char *) &metadata, APPLICATION_METADATA_ADDRESS, sizeof(app_metadata_t));
+        if(rc != 0){
+            //printf("Error writing metadata from flash\r\n");
+            raise_error();
+        }
+    }
+
+    resume_bus_timeout();
+}
+
+void I2C_Framework::suspend_bus_timeout()
+{
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    // Hardware timeout only set up once the interrupt serves the node
+    if(address_assigned){
+        set_bus_timeout(false);
+    }
+#endif
+}
+
+void I2C_Framework::resume_bus_timeout()
+{
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    if(address_assigned){
+        set_bus_timeout(true);
+    }
+#endif
+
+    // SCL stretched by this node meanwhile, timeout restarts from the end of the flash work
+    bus_stuck_line = 0;
+}
+
+void I2C_Framework::setup_i2c()
+{
+    slave.frequency(I2C_FREQ);
+    master.frequency(I2C_FREQ);
+
+    // Reclaim address used before reset if no other node took it
+    if(is_valid_address(active_app_metadata_ram.slave_addr)){
+        char data[1];
+        rc = master.read(active_app_metadata_ram.slave_addr << 1, data, 1, false);
+        if(rc != 0){
+            set_slave_address(active_app_metadata_ram.slave_addr);
+            return;
+        }
+    }
+
+    // Answer on address resolution address until the master assigns an address
+    address_assigned = false;
+    arp_start_time = us_ticker_read();
+    slave.address(ARP_ADDRESS << 1);
+    enable_general_call();
+}
+
+void I2C_Framework::process_general_call(char *buffer)
+{
+    // Read first, every node gets the end of the same transaction
+    uint32_t now = us_ticker_read();
+
+    switch(buffer[0]){
+        case GENERAL_CALL_BUS_MODE_CMD:
+            // Applied from loop_iteration() once the transaction is over, unsupported modes are ignored
+            if((uint8_t) buffer[1] <= I2C_FRAMEWORK_MAX_BUS_MODE){
+                bus_mode_request = buffer[1];
+            }
+            break;
+
+        case GENERAL_CALL_GROUP_WRITE_CMD:
+            // Nodes waiting for an address and nodes of other groups ignore it
+            if(address_assigned && (buffer[1] == GENERAL_CALL_ALL_GROUPS || (uint8_t) buffer[1] == active_app_metadata_ram.group)){
+                process_group_write(buffer);
+            }
+            break;
+
+        case GENERAL_CALL_SYNC_LATCH_CMD:
+            latch_time = now;
+            latch_count++;
+            for(int i = 0; i < SYNC_HOOK_COUNT; i++){
+                if(sync_hooks[i] != nullptr){
+                    sync_hooks[i](sync_hook_contexts[i], now + time_offset);
+                }
+            }
+            break;
+
+        case GENERAL_CALL_TIME_SYNC_CMD:{
+            // Master time of the last latch, the offset to the local clock gives the node time base
+            uint32_t master_time = (uint8_t) buffer[1] | (uint8_t) buffer[2] << 8 | (uint8_t) buffer[3] << 16 | (uint32_t) (uint8_t) buffer[4] << 24;
+            if(latch_count > 0){
+                time_offset = master_time - latch_time;
+                time_sync_count++;
+            }
+            break;
+        }
+
+        default:
+            // Unknown command
+            break;
+    }
+}
+
+void I2C_Framework::process_group_write(char *buffer)
+{
+    // Register write moved to the start of the buffer, rest of the buffer stays cleared
+    rx_length -= 2;
+    memmove(buffer, &buffer[2], I2C_RX_BUFFER_SIZE - 2);
+    memset(&buffer[I2C_RX_BUFFER_SIZE - 2], 0, 2);
+
+    // Same path as a write addressed to this node, registers with their own buffer get their data there
+    rx_general_call = false;
+    rx_target = get_write_target(buffer[0], &rx_target_size);
+    if(rx_target != &buffer[1] && rx_length > 1){
+        memcpy(rx_target, &buffer[1], rx_length - 1 < rx_target_size ? rx_length - 1 : rx_target_size);
+    }
+    process_write(buffer);
+
+    rx_general_call = true;
+    rx_target = &buffer[1];
+}
+
+void I2C_Framework::set_bus_mode(int mode)
+{
+    bus_mode = mode;
+
+    // FM+ drive before the timing needing it
+    set_fast_mode_plus(mode == BUS_MODE_FAST_PLUS);
+    slave.frequency(bus_mode_frequency[mode]);
+    master.frequency(bus_mode_frequency[mode]);
+    enable_general_call();
+
+    bus_speed[1] = mode;
+    bus_speed[2] = mode == BUS_MODE_FAST_PLUS;
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    // Changing the timing resets the peripheral, take it over again
+    if(address_assigned){
+        start_interrupt_slave();
+    }
+#endif
+}
+
+void I2C_Framework::process_arp_write(char *buffer)
+{
+    if(buffer[0] != ARP_ASSIGN_CMD || memcmp(&buffer[1], arp_uid, 4) != 0){
+        // Command for another node
+        return;
+    }
+
+    uint8_t address = buffer[5];
+    if(!is_valid_address(address)){
+        return;
+    }
+
+    set_slave_address(address);
+}
+
+bool I2C_Framework::is_valid_address(uint16_t address)
+{
+    // Only 7-bit addresses outside reserved ranges
+    return address >= 0x08 && address <= 0x77 && address != ARP_ADDRESS;
+}
+
+void I2C_Framework::set_slave_address(uint16_t address)
+{
+    slave_addr = address;
+    slave.address(slave_addr << 1);
+    enable_general_call();
+    address_assigned = true;
+    i2c_register = 0;
+
+    // Keep address for next boot
+    if(active_app_metadata_ram.slave_addr != slave_addr){
+        active_app_metadata_ram.slave_addr = slave_addr;
+        request_metadata_save();
+    }
+
+#if I2C_FRAMEWORK_INTERRUPT_MODE
+    // Serve transactions from the I2C interrupt from now on
+    start_interrupt_slave();
+#endif
+}
+
+void I2C_Framework::probe_i2c_address()
+{
+    // Generate a random slave address with unique ID
+    slave_addr = (id) % 95 + 0x10;
+
+    // Generate a random wait time with unique ID
+    uint16_t wait_time = (id) % 1000;
+
+    // Set slave address to 0x00 to disable slave for now
+    slave.address(0);
+
+    // Wait for a random time to avoid collision
+    HAL_Delay(wait_time);
+
+    // Create a buffer to store data
+    char data[1];
+
+    // Check each address at most once
+    for(int i = 0; i < 0x70 - 0x10; i++){
+        rc = master.read(slave_addr << 1, data, 1, false);
+
+        if(rc != 0){
+            // If slave address is free, set slave address
+            set_slave_address(slave_addr);
+            return;
+        }
+
+        // If slave address is not free
+        if(slave_addr == 0x6F){
+            // If slave address is too high, reset to 0x10
+            slave_addr = 0x10;
+        } else {
+            slave_addr++;
+        }
+    }
+
+    // Every address answered, wait for a master on the address resolution address and probe again later
+    arp_start_time = us_ticker_read();
+    slave.address(ARP_ADDRESS << 1);
+    enable_general_call();
+}
+
+void I2C_Framework::init_register_table(){
+    // Every register shares the default value until a callback or built-in is set
+    i2c_register_entry_t *entry = &i2c_register_slots[0];
+    entry->read_callback = nullptr;
+    entry->write_callback = nullptr;
+    entry->builtin_write = nullptr;
+    entry->builtin_read = nullptr;
+    entry->snapshot = nullptr;
+    entry->write_size = 0;
+    entry->read_data = &i2c_read_default_value;
+    entry->data_size = 1;
+    entry->write_buffer = nullptr;
+    entry->write_buffer_size = 0;
+    entry->map_context = nullptr;
+    entry->map_read = nullptr;
+    entry->map_write = nullptr;
+    entry->bank_first = 0;
+    entry->bank_size = 0;
+    entry->prefetch = true;
+    memset(i2c_register_index, 0, sizeof(i2c_register_index));
+    i2c_register_slot_count = 1;
+
+    // Built-in read registers
+    get_register_slot(UID_REG)->read_data = (const char *) &id;
+    get_register_slot(UID_REG)->data_size = 4;
+    get_register_slot(VERSION_HASH_REG)->read_data = (const char *) active_app_header->firmware_version_hash;
+    get_register_slot(VERSION_HASH_REG)->data_size = 32;
+    get_register_slot(GROUP_REG)->read_data = (const char *) &active_app_metadata_ram.group;
+    get_register_slot(GROUP_REG)->data_size = 1;
+    get_register_slot(SENSOR_TYPE_REG)->read_data = active_app_metadata_ram.sensor_type;
+    get_register_slot(SENSOR_TYPE_REG)->data_size = 32;
+    get_register_slot(NAME_REG)->read_data = active_app_metadata_ram.name;
+    get_register_slot(NAME_REG)->data_size = 32;
+    get_register_slot(METADATA_STATUS_REG)->read_data = (const char *) &metadata_commit_pending;
+    get_register_slot(METADATA_STATUS_REG)->data_size = 1;
+    get_register_slot(FIFO_WATERMARK_REG)->read_data = (const char *) &fifo_watermark;
+    get_register_slot(FIFO_WATERMARK_REG)->data_size = 2;
+    get_register_slot(BUS_SPEED_REG)->read_data = (const char *) bus_speed;
+    get_register_slot(BUS_SPEED_REG)->data_size = BUS_SPEED_SIZE;
+#if I2C_FRAMEWORK_STATS
+    get_register_slot(STATS_REG)->read_data = (const char *) stats_histogram;
+    get_register_slot(STATS_REG)->data_size = sizeof(stats_histogram);
+#endif
+#if I2C_FRAMEWORK_LOW_POWER
+    get_register_slot(POWER_STATS_REG)->read_data = (const char *) &power_stats;
+    get_register_slot(POWER_STATS_REG)->data_size = POWER_STATS_SIZE;
+#endif
+    get_register_slot(BUS_HEALTH_REG)->read_data = (const char *) &bus_health;
+    get_register_slot(BUS_HEALTH_REG)->data_size = BUS_HEALTH_SIZE;
+
+    // Built-in write registers
+    get_register_slot(GROUP_REG)->write_size = 1;
+    get_register_slot(SENSOR_TYPE_REG)->write_size = 32;
+    get_register_slot(NAME_REG)->write_size = 32;
+    get_register_slot(FIFO_WATERMARK_REG)->write_size = 2;
+    get_register_slot(FIFO_DRAIN_REG)->write_size = 1;
+    get_register_slot(FIRMWARE_REG)->builtin_write = &I2C_Framework::write_firmware_reg;
+    get_register_slot(GROUP_REG)->builtin_write = &I2C_Framework::write_group_reg;
+    get_register_slot(SENSOR_TYPE_REG)->builtin_write = &I2C_Framework::write_sensor_type_reg;
+    get_register_slot(NAME_REG)->builtin_write = &I2C_Framework::write_name_reg;
+    get_register_slot(STREAM_REG)->builtin_write = &I2C_Framework::write_stream_reg;
+    get_register_slot(FIFO_WATERMARK_REG)->builtin_write = &I2C_Framework::write_fifo_watermark_reg;
+    get_register_slot(FIFO_DRAIN_REG)->builtin_write = &I2C_Framework::write_fifo_drain_reg;
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    get_register_slot(FIRMWARE_STAGE_REG)->builtin_write = &I2C_Framework::write_firmware_stage_reg;
+#endif
+
+    // Built-in registers built at read time
+    get_register_slot(STREAM_REG)->builtin_read = &I2C_Framework::read_stream_reg;
+    get_register_slot(STREAM_REG)->data_size = I2C_STREAM_FRAME_SIZE;
+    get_register_slot(STREAM_STATUS_REG)->builtin_read = &I2C_Framework::read_stream_status_reg;
+    get_register_slot(STREAM_STATUS_REG)->data_size = I2C_STREAM_STATUS_SIZE;
+    get_register_slot(FIFO_LEVEL_REG)->builtin_read = &I2C_Framework::read_fifo_level_reg;
+    get_register_slot(FIFO_LEVEL_REG)->data_size = I2C_FIFO_LEVEL_SIZE;
+    get_register_slot(FIFO_DRAIN_REG)->builtin_read = &I2C_Framework::read_fifo_drain_reg;
+    get_register_slot(FIFO_DRAIN_REG)->data_size = I2C_STREAM_FRAME_SIZE;
+    get_register_slot(ALERT_STATUS_REG)->builtin_read = &I2C_Framework::read_alert_status_reg;
+    get_register_slot(ALERT_STATUS_REG)->data_size = 1;
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    get_register_slot(FIRMWARE_STAGE_REG)->builtin_read = &I2C_Framework::read_firmware_stage_reg;
+    get_register_slot(FIRMWARE_STAGE_REG)->data_size = FIRMWARE_STAGE_STATUS_SIZE;
+#endif
+    get_register_slot(SYNC_REG)->builtin_read = &I2C_Framework::read_sync_reg;
+    get_register_slot(SYNC_REG)->data_size = SYNC_STATUS_SIZE;
+}
+
+I2C_Framework::i2c_register_entry_t *I2C_Framework::get_register_entry(uint8_t reg)
+{
+    return &i2c_register_slots[i2c_register_index[reg]];
+}
+
+bool I2C_Framework::needs_register_slot(uint8_t reg)
+{
+    // Default value and bank slots are shared with other registers
+    return i2c_register_index[reg] == 0 || get_register_entry(reg)->bank_size > 0;
+}
+
+uint8_t I2C_Framework::allocate_register_slot()
+{
+    if(i2c_register_slot_count >= I2C_REGISTER_SLOTS){
+        return 0;
+    }
+    i2c_register_slots[i2c_register_slot_count] = i2c_register_slots[0];
+    return i2c_register_slot_count++;
+}
+
+I2C_Framework::i2c_register_entry_t *I2C_Framework::get_register_slot(uint8_t reg)
+{
+    if(needs_register_slot(reg)){
+        uint8_t slot = allocate_register_slot();
+        if(slot == 0){
+            return nullptr;
+        }
+        i2c_register_index[reg] = slot;
+    }
+    return get_register_entry(reg);
+}
+
+void I2C_Framework::init_i2c_callback_size(int size){
+    // Register slots are statically sized, nothing to allocate
+    (void) size;
+}
+
+void I2C_Framework::add_i2c_callback(int register_address, char * (*read_callback)(), int (*write_callback)(char *buffer), int data_size){
+    if(register_address < 0 || register_address >= I2C_REGISTER_COUNT){
+        return;
+    }
+    i2c_register_entry_t *entry = get_register_slot(register_address);
+    if(entry == nullptr){
+        return;
+    }
+    entry->read_callback = read_callback;
+    entry->write_callback = write_callback;
+    entry->map_read = nullptr;
+    entry->map_write = nullptr;
+    entry->snapshot = nullptr;
+    entry->data_size = data_size;
+    entry->write_size = data_size;
+    entry->prefetch = false;
+}
+
+int I2C_Framework::add_i2c_register_bank(int first_register, char *memory, int size, bool writable){
+    // Built-in registers start at FIRMWARE_REG
+    if(first_register < 0 || size <= 0 || first_register + size > FIRMWARE_REG){
+        return -1;
+    }
+
+#if !I2C_FRAMEWORK_INTERRUPT_MODE
+    // A polled write has no known length
+    if(writable){
+        return -1;
+    }
+#endif
+
+    // One slot for the whole bank, the register gives the offset in it
+    uint8_t slot = allocate_register_slot();
+    if(slot == 0){
+        return -1;
+    }
+    i2c_register_entry_t *entry = &i2c_register_slots[slot];
+    entry->builtin_write = writable ? &I2C_Framework::write_register_bank : nullptr;
+    entry->read_data = memory;
+    entry->data_size = size;
+    entry->write_size = writable ? size : 0;
+    entry->bank_first = first_register;
+    entry->bank_size = size;
+    for(int i = 0; i < size; i++){
+        i2c_register_index[first_register + i] = slot;
+    }
+    return 0;
+}
+
+void I2C_Framework::set_i2c_prefetch(int register_address, bool enable){
+    if(register_address < 0 || register_address >= I2C_REGISTER_COUNT){
+        return;
+    }
+    i2c_register_entry_t *entry = get_register_slot(register_address);
+    if(entry != nullptr){
+        entry->prefetch = enable;
+    }
+}
+
+void I2C_Framework::add_i2c_snapshot(int register_address, SnapshotBuffer *snapshot){
+    if(register_address < 0 || register_address >= I2C_REGISTER_COUNT){
+        return;
+    }
+    i2c_register_entry_t *entry = get_register_slot(register_address);
+    if(entry == nullptr){
+        return;
+    }
+    entry->read_callback = nullptr;
+    entry->map_read = nullptr;
+    entry->snapshot = snapshot;
+    entry->prefetch = true;
+}
+
+void I2C_Framework::set_i2c_write_buffer(int register_address, char *write_buffer, int size){
+    if(register_address < 0 || register_address >= I2C_REGISTER_COUNT){
+        return;
+    }
+    i2c_register_entry_t *entry = get_register_slot(register_address);
+    if(entry == nullptr){
+        return;
+    }
+    entry->write_buffer = write_buffer;
+    entry->write_buffer_size = size;
+    entry->write_size = size;
+}
+
+void I2C_Framework::set_stream_buffers(RingBuffer *tx_stream, RingBuffer *rx_stream){
+    this->tx_stream = tx_stream;
+    this->rx_stream = rx_stream;
+
+    // Polled writes read whole frames
+    if(rx_stream != nullptr){
+        polled_rx_size = I2C_RX_BUFFER_SIZE;
+    }
+}
+
+void I2C_Framework::set_sample_fifo(RingBuffer *fifo, int sample_size){
+    if(sample_size <= 0 || sample_size > I2C_FIFO_MAX_SAMPLE_SIZE){
+        return;
+    }
+    fifo_record_size = I2C_FIFO_TIMESTAMP_SIZE + sample_size;
+    this->fifo = fifo;
+}
+
+int I2C_Framework::push_sample(const void *sample){
+    if(fifo == nullptr || fifo->space() < (uint32_t) fifo_record_size){
+        fifo_overflow = true;
+        return -1;
+    }
+
+    // Record written at once, the master never drains half a record
+    char record[I2C_FIFO_TIMESTAMP_SIZE + I2C_FIFO_MAX_SAMPLE_SIZE];
+    uint32_t timestamp = get_time();
+    for(int i = 0; i < I2C_FIFO_TIMESTAMP_SIZE; i++){
+        record[i] = timestamp >> (8 * i);
+    }
+    memcpy(&record[I2C_FIFO_TIMESTAMP_SIZE], sample, fifo_record_size - I2C_FIFO_TIMESTAMP_SIZE);
+    fifo->write(record, fifo_record_size);
+
+    return 0;
+}
+
+void I2C_Framework::set_alert_mask(uint8_t mask){
+    alert_mask = mask;
+    update_alert();
+}
+
+void I2C_Framework::raise_error(){
+    error_latched = true;
+    led_status = 1;
+    raise_alert(ALERT_ERROR);
+}
+
+void I2C_Framework::raise_alert(uint8_t sources){
+    core_util_critical_section_enter();
+    alert_status |= sources;
+    alert_responded = false;
+    update_alert();
+    core_util_critical_section_exit();
+}
+
+uint32_t I2C_Framework::idle(uint32_t max_time_ms){
+#if I2C_FRAMEWORK_LOW_POWER
+    // Time since the last call was spent running, the us ticker does not count Stop mode
+    uint32_t now = us_ticker_read();
+    power_run_us += now - power_state_start;
+
+    // Watchdog keeps running in Stop mode
+    check_scl();
+
+    uint32_t stop_time = enter_stop_mode((max_time_ms < STOP_MAX_TIME_MS ? max_time_ms : STOP_MAX_TIME_MS) * 1000);
+    if(stop_time > 0){
+        power_stop_us += stop_time;
+        power_stats.wakeup_count++;
+    }
+    power_state_start = us_ticker_read();
+
+    // Whole ms only, the rest is kept for next time
+    power_stats.run_time_ms += power_run_us / 1000;
+    power_run_us %= 1000;
+    power_stats.stop_time_ms += power_stop_us / 1000;
+    power_stop_us %= 1000;
+    return stop_time;
+#else
+    (void) max_time_ms;
+    return 0;
+#endif
+}
+
+void I2C_Framework::get_power_stats(power_stats_t *stats){
+    memcpy(stats, &power_stats, sizeof(power_stats_t));
+}
+
+void I2C_Framework::get_bus_health(bus_health_t *health){
+    memcpy(health, &bus_health, sizeof(bus_health_t));
+}
+
+#if I2C_FRAMEWORK_LOW_POWER
+bool I2C_Framework::is_idle(){
+#if I2C_FRAMEWORK_FIRMWARE_STAGING
+    if(firmware_stager.is_busy() || firmware_stager.is_install_requested()){
+        return false;
+    }
+#endif
+    return address_assigned && !metadata_commit_pending && bus_mode_request == bus_mode && bus_stuck_line == 0 && !bus_timeout_pending;
+}
+#endif
+
+int I2C_Framework::add_sync_hook(void (*hook)(void *context, uint32_t timestamp), void *context){
+    for(int i = 0; i < SYNC_HOOK_COUNT; i++){
+        if(sync_hooks[i] == nullptr){
+            sync_hook_contexts[i] = context;
+            sync_hooks[i] = hook;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint32_t I2C_Framework::get_time(){
+    return us_ticker_read() + time_offset;
+}
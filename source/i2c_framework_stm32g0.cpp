@@ -0,0 +1,459 @@
+#include "i2c_framework.h"
+
+#if defined(TARGET_STM32G0) && I2C_FRAMEWORK_LOW_POWER
+#include "hal/lp_ticker_api.h"
+#include "hal/sleep_api.h"
+#endif
+
+#if defined(TARGET_STM32G0)
+
+// GPIO port of a pin with its clock enabled, from the mbed STM32 GPIO driver
+extern GPIO_TypeDef *Set_GPIO_Clock(uint32_t port_idx);
+
+void I2C_Framework::set_fast_mode_plus(bool enable)
+{
+    // 20 mA drive of PB6 (SCL) and PB7 (SDA) needed above 400 kHz
+    RCC->APBENR2 |= RCC_APBENR2_SYSCFGEN;
+    if(enable){
+        SYSCFG->CFGR1 |= SYSCFG_CFGR1_I2C_PB6_FMP | SYSCFG_CFGR1_I2C_PB7_FMP;
+    } else {
+        SYSCFG->CFGR1 &= ~(SYSCFG_CFGR1_I2C_PB6_FMP | SYSCFG_CFGR1_I2C_PB7_FMP);
+    }
+}
+
+void I2C_Framework::enable_general_call()
+{
+    // mbed clears GCEN each time it sets the slave address or frequency
+    I2C1->CR1 |= I2C_CR1_GCEN;
+}
+
+bool I2C_Framework::is_general_call()
+{
+    // mbed reports every write as WriteAddressed, ADDR and its address match code stay set until slave.read()
+    return (I2C1->ISR & (I2C_ISR_ADDR | I2C_ISR_ADDCODE)) == I2C_ISR_ADDR;
+}
+
+void I2C_Framework::release_bus()
+{
+    // Peripheral off releases the lines it drives and clears its state machine
+    I2C1->CR1 &= ~I2C_CR1_PE;
+
+    GPIO_TypeDef *scl_port = Set_GPIO_Clock(STM_PORT(bus_scl));
+    GPIO_TypeDef *sda_port = Set_GPIO_Clock(STM_PORT(bus_sda));
+    uint32_t scl_pin = STM_PIN(bus_scl);
+    uint32_t sda_pin = STM_PIN(bus_sda);
+    uint32_t scl_moder = scl_port->MODER & (3UL << (scl_pin * 2));
+    uint32_t sda_moder = sda_port->MODER & (3UL << (sda_pin * 2));
+
+    // SCL and SDA as outputs, released high, still open-drain from the I2C setup
+    scl_port->BSRR = 1UL << scl_pin;
+    sda_port->BSRR = 1UL << sda_pin;
+    scl_port->MODER = (scl_port->MODER & ~(3UL << (scl_pin * 2))) | (1UL << (scl_pin * 2));
+    sda_port->MODER = (sda_port->MODER & ~(3UL << (sda_pin * 2))) | (1UL << (sda_pin * 2));
+
+    // A device stopped in the middle of a byte releases SDA within 9 clocks, at 100 kHz
+    bool sda_stuck = !(sda_port->IDR & (1UL << sda_pin));
+    for(int i = 0; i < BUS_RECOVERY_CLOCKS && !(sda_port->IDR & (1UL << sda_pin)); i++){
+        scl_port->BSRR = 1UL << (scl_pin + 16);
+        wait_us(5);
+        scl_port->BSRR = 1UL << scl_pin;
+        wait_us(5);
+    }
+
+    // STOP, SDA rising while SCL is high, ends the transfer of the device which held SDA
+    if(sda_stuck){
+        sda_port->BSRR = 1UL << (sda_pin + 16);
+        wait_us(5);
+        sda_port->BSRR = 1UL << sda_pin;
+        wait_us(5);
+    }
+
+    // Pins back to the I2C alternate function
+    scl_port->MODER = (scl_port->MODER & ~(3UL << (scl_pin * 2))) | scl_moder;
+    sda_port->MODER = (sda_port->MODER & ~(3UL << (sda_pin * 2))) | sda_moder;
+}
+
+#if I2C_FRAMEWORK_LOW_POWER
+// Wakes the MCU before the watchdog expires, nothing to do in the handler
+static LowPowerTimeout stop_wakeup;
+
+static void stop_wakeup_event()
+{
+}
+
+void I2C_Framework::setup_low_power()
+{
+    // HSI16 is the only I2C1 clock able to wake the MCU from Stop mode on an address match
+    RCC->CCIPR = (RCC->CCIPR & ~RCC_CCIPR_I2C1SEL) | RCC_CCIPR_I2C1SEL_1;
+}
+
+uint32_t I2C_Framework::enter_stop_mode(uint32_t max_time_us)
+{
+    stop_wakeup.attach(&stop_wakeup_event, std::chrono::microseconds(max_time_us));
+
+    // Interrupts stay masked from the last check to the WFI, a pending one ends Stop mode at once
+    core_util_critical_section_enter();
+    if(!is_idle() || (I2C1->ISR & I2C_ISR_BUSY)){
+        core_util_critical_section_exit();
+        stop_wakeup.detach();
+        return 0;
+    }
+
+    us_timestamp_t stop_start = ticker_read_us(get_lp_ticker_data());
+    hal_deepsleep();
+    uint32_t stop_time = ticker_read_us(get_lp_ticker_data()) - stop_start;
+
+    // Clocks are restored, latency runs until the address match is served
+    // The clock start-up inside hal_deepsleep is not counted, the us ticker does not run in Stop mode
+    wake_time = us_ticker_read();
+    wake_pending = true;
+    core_util_critical_section_exit();
+
+    // Woken by the timer, no transaction to measure
+    wake_pending = false;
+    stop_wakeup.detach();
+    return stop_time;
+}
+#endif
+
+#else
+
+void I2C_Framework::set_fast_mode_plus(bool enable)
+{
+    // No FM+ drive control on this target
+    (void) enable;
+}
+
+void I2C_Framework::enable_general_call()
+{
+    // General calls are reported as such by I2CSlave on this target
+}
+
+bool I2C_Framework::is_general_call()
+{
+    return false;
+}
+
+void I2C_Framework::release_bus()
+{
+    // Lines clocked as open-drain GPIOs, the I2C driver of a hardware target must take the pins back afterwards
+    DigitalInOut scl_line(bus_scl, PIN_OUTPUT, OpenDrain, 1);
+    DigitalInOut sda_line(bus_sda, PIN_OUTPUT, OpenDrain, 1);
+
+    // A device stopped in the middle of a byte releases SDA within 9 clocks, at 100 kHz
+    bool sda_stuck = sda_line.read() == 0;
+    for(int i = 0; i < BUS_RECOVERY_CLOCKS && sda_line.read() == 0; i++){
+        scl_line = 0;
+        wait_us(5);
+        scl_line = 1;
+        wait_us(5);
+    }
+
+    // STOP, SDA rising while SCL is high, ends the transfer of the device which held SDA
+    if(sda_stuck){
+        sda_line = 0;
+        wait_us(5);
+        sda_line = 1;
+        wait_us(5);
+    }
+}
+
+#if I2C_FRAMEWORK_LOW_POWER
+void I2C_Framework::setup_low_power()
+{
+}
+
+uint32_t I2C_Framework::enter_stop_mode(uint32_t max_time_us)
+{
+    // No Stop mode on this target, keep running
+    (void) max_time_us;
+    return 0;
+}
+#endif
+
+#endif // TARGET_STM32G0
+
+// Interrupt mode of other targets, e.g. the host simulation, is implemented with the target
+#if I2C_FRAMEWORK_INTERRUPT_MODE && defined(TARGET_STM32G0)
+
+// Framework served by the I2C interrupt
+I2C_Framework *I2C_Framework::instance = nullptr;
+
+void I2C_Framework::start_interrupt_slave()
+{
+    instance = this;
+
+    NVIC_DisableIRQ(I2C1_IRQn);
+
+    // Disable peripheral to reset its state machine
+    I2C1->CR1 &= ~I2C_CR1_PE;
+
+    // Set own address, OA1EN must be cleared before changing it
+    I2C1->OAR1 = 0;
+    I2C1->OAR1 = I2C_OAR1_OA1EN | (slave_addr << 1);
+
+    // Alert response address is only enabled while ALERT# is asserted
+    set_alert_response(alert_asserted);
+
+    // Clock stretching on, so the master waits while data is prepared
+    I2C1->CR1 &= ~(I2C_CR1_NOSTRETCH | I2C_CR1_SBC);
+
+    // Answer general calls for bus wide commands
+    I2C1->CR1 |= I2C_CR1_GCEN;
+
+#if I2C_FRAMEWORK_LOW_POWER
+    // Address match wakes the MCU from Stop mode
+    I2C1->CR1 |= I2C_CR1_WUPEN;
+#endif
+
+    // SCL held low for BUS_STUCK_TIMEOUT_MS raises TIMEOUT, TIMEOUTA counts 2048 I2C clocks
+    uint32_t i2c_clock = (RCC->CCIPR & RCC_CCIPR_I2C1SEL) == RCC_CCIPR_I2C1SEL_1 ? HSI_VALUE : SystemCoreClock;
+    uint32_t timeout = (i2c_clock / 1000) * BUS_STUCK_TIMEOUT_MS / 2048 - 1;
+    I2C1->TIMEOUTR = 0;
+    I2C1->TIMEOUTR = I2C_TIMEOUTR_TIMOUTEN | ((timeout < 0xFFF ? timeout : 0xFFF) << I2C_TIMEOUTR_TIMEOUTA_Pos);
+
+    // Enable address match, RXNE, TXIS, STOP, NACK and error interrupts
+    I2C1->CR1 |= I2C_CR1_ADDRIE | I2C_CR1_RXIE | I2C_CR1_TXIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
+
+#if I2C_FRAMEWORK_DMA_MODE
+    // DMA1 channel 2 sends to TXDR, channel 3 receives from RXDR
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+    DMAMUX1_Channel1->CCR = DMA_REQUEST_I2C1_TX;
+    DMAMUX1_Channel2->CCR = DMA_REQUEST_I2C1_RX;
+    DMA1_Channel2->CPAR = (uint32_t) &I2C1->TXDR;
+    DMA1_Channel3->CPAR = (uint32_t) &I2C1->RXDR;
+
+    NVIC_SetVector(DMA1_Channel2_3_IRQn, (uint32_t) &I2C_Framework::dma_irq);
+    NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0);
+    NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+#endif
+
+    // Enable peripheral
+    I2C1->CR1 |= I2C_CR1_PE;
+
+    // Replace the mbed handler by the framework one
+    NVIC_SetVector(I2C1_IRQn, (uint32_t) &I2C_Framework::i2c_irq);
+    NVIC_SetPriority(I2C1_IRQn, 0);
+    NVIC_EnableIRQ(I2C1_IRQn);
+}
+
+void I2C_Framework::i2c_irq()
+{
+    instance->i2c_irq_handler();
+}
+
+void I2C_Framework::i2c_irq_handler()
+{
+    uint32_t status = I2C1->ISR;
+
+    // Events of the previous transaction first: a repeated start or a short transaction can leave ADDR pending
+    // with its last byte or its STOP, served after them so on_stop() does not end the new transaction
+    if(status & I2C_ISR_RXNE){
+        on_receive_byte(I2C1->RXDR);
+
+#if I2C_FRAMEWORK_DMA_MODE
+        // Register received, the rest goes directly to its buffer
+        if(rx_length == 1){
+            start_rx_dma(rx_target, rx_target_size);
+        }
+#endif
+    }
+
+    if(status & I2C_ISR_NACKF){
+        // Master does not want more data
+        I2C1->ICR = I2C_ICR_NACKCF;
+    }
+
+    if(status & I2C_ISR_STOPF){
+        I2C1->ICR = I2C_ICR_STOPCF;
+#if I2C_FRAMEWORK_DMA_MODE
+        stop_dma();
+#endif
+        // Byte preloaded in TXDR when the master stopped reading was never sent
+        if(tx_preloaded && !(I2C1->ISR & I2C_ISR_TXE)){
+            tx_index--;
+        }
+        tx_preloaded = false;
+        on_stop();
+    }
+
+    if(status & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR)){
+        // Peripheral releases the bus by itself, drop the transaction
+        I2C1->ICR = I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+#if I2C_FRAMEWORK_DMA_MODE
+        stop_dma();
+#endif
+        if(status & (I2C_ISR_BERR | I2C_ISR_OVR)){
+            on_bus_error();
+        } else {
+            on_arbitration_lost();
+        }
+    }
+
+    if(status & I2C_ISR_TIMEOUT){
+        // Bus stuck, recovered from the main loop
+        I2C1->ICR = I2C_ICR_TIMOUTCF;
+#if I2C_FRAMEWORK_DMA_MODE
+        stop_dma();
+#endif
+        on_bus_timeout();
+    }
+
+    if(status & I2C_ISR_ADDR){
+        bool transmit = (status & I2C_ISR_DIR) != 0;
+        uint8_t address_code = (status & I2C_ISR_ADDCODE) >> I2C_ISR_ADDCODE_Pos;
+        bool general_call = address_code == 0;
+
+#if I2C_FRAMEWORK_DMA_MODE
+        // Repeated start ends the reception of the write before it
+        if(rx_dma_active){
+            stop_dma();
+        }
+#endif
+
+        if(transmit){
+            // Flush TXDR so the first TXIS sends data of the current register
+            I2C1->ISR |= I2C_ISR_TXE;
+            tx_preloaded = false;
+        }
+
+        if(transmit && address_code == ALERT_RESPONSE_ADDRESS){
+            on_alert_response();
+        } else {
+            on_address_match(transmit, general_call);
+        }
+
+#if I2C_FRAMEWORK_DMA_MODE
+        // Send directly from the register data
+        if(transmit && tx_size > 0){
+            start_tx_dma(tx_data, tx_size);
+        }
+#endif
+
+        // Release clock stretching
+        I2C1->ICR = I2C_ICR_ADDRCF;
+    }
+
+    if(status & I2C_ISR_TXIS){
+        // Counted as sent once in TXDR, the stop takes it back if the master did not read it
+        int index = tx_index;
+        I2C1->TXDR = on_transmit_byte();
+        tx_preloaded = tx_index != index;
+    }
+}
+
+void I2C_Framework::set_bus_timeout(bool enable)
+{
+    // TIMEOUTA set by start_interrupt_slave() is kept, only the detection stops
+    if(enable){
+        I2C1->TIMEOUTR |= I2C_TIMEOUTR_TIMOUTEN;
+    } else {
+        I2C1->TIMEOUTR &= ~I2C_TIMEOUTR_TIMOUTEN;
+    }
+}
+
+void I2C_Framework::set_alert_response(bool enable)
+{
+    // OA2EN must be cleared before changing the address
+    I2C1->OAR2 = 0;
+    if(enable){
+        I2C1->OAR2 = I2C_OAR2_OA2EN | (ALERT_RESPONSE_ADDRESS << 1);
+    }
+}
+
+#if I2C_FRAMEWORK_DMA_MODE
+
+void I2C_Framework::start_tx_dma(const char *data, int size)
+{
+    // TXIS is served by DMA, no interrupt per byte
+    I2C1->CR1 &= ~I2C_CR1_TXIE;
+
+    DMA1_Channel2->CCR = 0;
+    DMA1_Channel2->CMAR = (uint32_t) data;
+    DMA1_Channel2->CNDTR = size;
+    DMA1_Channel2->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE | DMA_CCR_EN;
+
+    tx_dma_size = size;
+    tx_dma_active = true;
+
+    I2C1->CR1 |= I2C_CR1_TXDMAEN;
+}
+
+void I2C_Framework::start_rx_dma(char *data, int size)
+{
+    if(size <= 0){
+        return;
+    }
+
+    // RXNE is served by DMA, no interrupt per byte
+    I2C1->CR1 &= ~I2C_CR1_RXIE;
+
+    DMA1_Channel3->CCR = 0;
+    DMA1_Channel3->CMAR = (uint32_t) data;
+    DMA1_Channel3->CNDTR = size;
+    DMA1_Channel3->CCR = DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_EN;
+
+    rx_dma_size = size;
+    rx_dma_active = true;
+
+    I2C1->CR1 |= I2C_CR1_RXDMAEN;
+}
+
+void I2C_Framework::stop_dma()
+{
+    // Count bytes received by DMA
+    if(rx_dma_active){
+        rx_length += rx_dma_size - DMA1_Channel3->CNDTR;
+        rx_dma_active = false;
+    }
+
+    // Count bytes moved to TXDR by DMA, the last one may still be there
+    if(tx_dma_active){
+        tx_index = tx_dma_size - DMA1_Channel2->CNDTR;
+        tx_preloaded = tx_index > 0;
+        tx_dma_active = false;
+    }
+
+    DMA1_Channel2->CCR = 0;
+    DMA1_Channel3->CCR = 0;
+    DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+    // Back to interrupt per byte until next transfer
+    I2C1->CR1 &= ~(I2C_CR1_TXDMAEN | I2C_CR1_RXDMAEN);
+    I2C1->CR1 |= I2C_CR1_TXIE | I2C_CR1_RXIE;
+}
+
+void I2C_Framework::dma_irq()
+{
+    instance->dma_irq_handler();
+}
+
+void I2C_Framework::dma_irq_handler()
+{
+    uint32_t status = DMA1->ISR;
+
+    if(status & DMA_ISR_TCIF2){
+        // All data sent, master reading more gets the default value
+        DMA1->IFCR = DMA_IFCR_CGIF2;
+        DMA1_Channel2->CCR = 0;
+        tx_index = tx_size;
+        tx_preloaded = true;
+        tx_dma_active = false;
+        I2C1->CR1 &= ~I2C_CR1_TXDMAEN;
+        I2C1->CR1 |= I2C_CR1_TXIE;
+    }
+
+    if(status & DMA_ISR_TCIF3){
+        // Buffer full, extra data is dropped byte per byte
+        DMA1->IFCR = DMA_IFCR_CGIF3;
+        DMA1_Channel3->CCR = 0;
+        rx_length += rx_dma_size;
+        rx_dma_active = false;
+        I2C1->CR1 &= ~I2C_CR1_RXDMAEN;
+        I2C1->CR1 |= I2C_CR1_RXIE;
+    }
+}
+
+#endif // I2C_FRAMEWORK_DMA_MODE
+
+#endif // I2C_FRAMEWORK_INTERRUPT_MODE && TARGET_STM32G0
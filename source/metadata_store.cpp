@@ -0,0 +1,203 @@
+#include "metadata_store.h"
+
+MetadataStore::MetadataStore(FlashIAP &flash, uint32_t address, int page_count, uint32_t data_size) : flash(flash), address(address), page_count(page_count), data_size(data_size)
+{
+    page_size = 0;
+    program_size = 0;
+    record_size = 0;
+    has_record = false;
+    latest_address = 0;
+    latest_sequence = 0;
+    latest_size = 0;
+    active_page = 0;
+    active_slot_size = 0;
+    write_offset = 0;
+}
+
+int MetadataStore::init()
+{
+    // Page and program sizes are only known once flash is initialized
+    page_size = flash.get_sector_size(address);
+    program_size = flash.get_page_size();
+
+    // Record is aligned on program size
+    record_size = get_slot_size(data_size);
+    if(record_size > METADATA_STORE_MAX_RECORD_SIZE || record_size > page_size){
+        return -1;
+    }
+
+    has_record = false;
+    active_page = 0;
+    active_slot_size = record_size;
+    write_offset = 0;
+
+    uint32_t sequence;
+    uint32_t size;
+    for(int page = 0; page < page_count; page++){
+        uint32_t page_address = address + page * page_size;
+        uint32_t slot_size = get_page_slot_size(page_address);
+
+        for(uint32_t offset = 0; offset + slot_size <= page_size; offset += slot_size){
+            if(read_record(page_address + offset, slot_size, &sequence, &size)){
+                // Keep the record with the highest sequence
+                if(!has_record || (int32_t) (sequence - latest_sequence) > 0){
+                    has_record = true;
+                    latest_sequence = sequence;
+                    latest_size = size;
+                    latest_address = page_address + offset;
+                    active_page = page;
+                    active_slot_size = slot_size;
+                }
+            }
+        }
+    }
+
+    if(!has_record){
+        return -1;
+    }
+
+    // Next write goes after the last used slot of the active page, even if it holds a broken record
+    uint32_t page_address = address + active_page * page_size;
+    write_offset = latest_address - page_address + active_slot_size;
+    while(write_offset + active_slot_size <= page_size && !is_blank(page_address + write_offset, active_slot_size)){
+        write_offset += active_slot_size;
+    }
+
+    return 0;
+}
+
+int MetadataStore::load(void *data)
+{
+    if(!has_record){
+        return -1;
+    }
+    return flash.read(data, latest_address + sizeof(record_header_t), latest_size < data_size ? latest_size : data_size);
+}
+
+bool MetadataStore::needs_migration()
+{
+    return has_record && latest_size != data_size;
+}
+
+int MetadataStore::save(const void *data)
+{
+    int rc;
+
+    if(record_size == 0){
+        return -1;
+    }
+
+    // Nothing to do if data is already the latest record
+    if(has_record && latest_size == data_size){
+        rc = flash.read(record, latest_address + sizeof(record_header_t), data_size);
+        if(rc == 0 && memcmp(record, data, data_size) == 0){
+            return 0;
+        }
+    }
+
+    // Active page full, holding records of another size or log empty, continue in the next erased page
+    if(!has_record || active_slot_size != record_size || write_offset + record_size > page_size || !is_blank(address + active_page * page_size + write_offset, record_size)){
+        int next_page = has_record ? (active_page + 1) % page_count : 0;
+        rc = flash.erase(address + next_page * page_size, page_size);
+        if(rc != 0){
+            return rc;
+        }
+        active_page = next_page;
+        active_slot_size = record_size;
+        write_offset = 0;
+    }
+
+    // Build record
+    uint32_t sequence = has_record ? latest_sequence + 1 : 0;
+    memset(record, flash.get_erase_value(), record_size);
+    record_header_t *header = (record_header_t *) record;
+    header->magic = METADATA_RECORD_MAGIC;
+    header->sequence = sequence;
+    header->size = data_size;
+    memcpy(&record[sizeof(record_header_t)], data, data_size);
+
+    header->crc = compute_crc(data_size);
+
+    // Program whole record at once
+    uint32_t record_address = address + active_page * page_size + write_offset;
+    rc = flash.program(record, record_address, record_size);
+    write_offset += record_size;
+    if(rc != 0){
+        return rc;
+    }
+
+    has_record = true;
+    latest_sequence = sequence;
+    latest_size = data_size;
+    latest_address = record_address;
+
+    return 0;
+}
+
+bool MetadataStore::read_record(uint32_t record_address, uint32_t slot_size, uint32_t *sequence, uint32_t *size)
+{
+    if(flash.read(record, record_address, slot_size) != 0){
+        return false;
+    }
+
+    // Size must fill the slot, which also keeps the CRC inside the record buffer
+    record_header_t *header = (record_header_t *) record;
+    if(header->magic != METADATA_RECORD_MAGIC || header->size == 0 || header->size > slot_size || get_slot_size(header->size) != slot_size){
+        return false;
+    }
+
+    if(compute_crc(header->size) != header->crc){
+        return false;
+    }
+
+    *sequence = header->sequence;
+    *size = header->size;
+    return true;
+}
+
+uint32_t MetadataStore::get_slot_size(uint32_t size)
+{
+    uint32_t slot_size = sizeof(record_header_t) + size;
+    return (slot_size + program_size - 1) / program_size * program_size;
+}
+
+uint32_t MetadataStore::get_page_slot_size(uint32_t page_address)
+{
+    // Slots of a page are written in order, the first one is the oldest record of the page
+    record_header_t header;
+    if(flash.read(&header, page_address, sizeof(record_header_t)) != 0 || header.magic != METADATA_RECORD_MAGIC){
+        return record_size;
+    }
+
+    uint32_t slot_size = get_slot_size(header.size);
+    if(header.size == 0 || header.size > METADATA_STORE_MAX_RECORD_SIZE || slot_size > METADATA_STORE_MAX_RECORD_SIZE || slot_size > page_size){
+        return record_size;
+    }
+    return slot_size;
+}
+
+uint32_t MetadataStore::compute_crc(uint32_t size)
+{
+    record_header_t *header = (record_header_t *) record;
+    uint32_t crc_value = 0;
+
+    MbedCRC<POLY_32BIT_ANSI, 32> crc;
+    crc.compute(&header->sequence, sizeof(record_header_t) - offsetof(record_header_t, sequence) + size, &crc_value);
+
+    return crc_value;
+}
+
+bool MetadataStore::is_blank(uint32_t blank_address, uint32_t size)
+{
+    uint8_t erase_value = flash.get_erase_value();
+
+    if(flash.read(record, blank_address, size) != 0){
+        return false;
+    }
+    for(uint32_t i = 0; i < size; i++){
+        if((uint8_t) record[i] != erase_value){
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#include "ring_buffer.h"
+#include <atomic>
+
+RingBuffer::RingBuffer(char *storage, uint32_t size) : storage(storage)
+{
+    // Power of two size, indexes wrap with a mask instead of a division
+    uint32_t capacity = 1;
+    while(capacity * 2 <= size && capacity * 2 != 0){
+        capacity *= 2;
+    }
+    mask = size > 0 ? capacity - 1 : 0;
+    if(size == 0){
+        this->storage = nullptr;
+    }
+
+    head = 0;
+    tail = 0;
+}
+
+uint32_t RingBuffer::write(const char *data, uint32_t length)
+{
+    if(length > space()){
+        length = space();
+    }
+
+    uint32_t index = head;
+    for(uint32_t i = 0; i < length; i++){
+        storage[(index + i) & mask] = data[i];
+    }
+
+    // Data must be in place before the consumer sees it
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    head = index + length;
+
+    return length;
+}
+
+uint32_t RingBuffer::read(char *data, uint32_t length)
+{
+    length = peek(data, length);
+    skip(length);
+    return length;
+}
+
+uint32_t RingBuffer::peek(char *data, uint32_t length)
+{
+    if(length > available()){
+        length = available();
+    }
+
+    uint32_t index = tail;
+    for(uint32_t i = 0; i < length; i++){
+        data[i] = storage[(index + i) & mask];
+    }
+
+    return length;
+}
+
+void RingBuffer::skip(uint32_t length)
+{
+    if(length > available()){
+        length = available();
+    }
+
+    // Data must be copied before the producer overwrites it
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    tail = tail + length;
+}
+
+uint32_t RingBuffer::available()
+{
+    return head - tail;
+}
+
+uint32_t RingBuffer::space()
+{
+    if(storage == nullptr){
+        return 0;
+    }
+    return mask + 1 - available();
+}
@@ -0,0 +1,37 @@
+#include "snapshot_buffer.h"
+#include <atomic>
+#include <cstring>
+
+SnapshotBuffer::SnapshotBuffer(char *storage, int size) : storage(storage), size(size)
+{
+    // Value is zero until the first publish
+    memset(storage, 0, 3 * size);
+    latest = 0;
+    reading = 0;
+}
+
+void SnapshotBuffer::publish(const void *data)
+{
+    // Buffer neither latest nor being sent, the reader can only move to the latest one
+    uint8_t index = 0;
+    while(index == latest || index == reading){
+        index++;
+    }
+
+    memcpy(&storage[index * size], data, size);
+
+    // Value must be complete before the reader sees it
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    latest = index;
+}
+
+const char *SnapshotBuffer::acquire()
+{
+    reading = latest;
+    return &storage[reading * size];
+}
+
+int SnapshotBuffer::get_size()
+{
+    return size;
+}
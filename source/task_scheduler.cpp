@@ -0,0 +1,141 @@
+#include "task_scheduler.h"
+
+TaskScheduler::TaskScheduler(I2C_Framework &framework) : framework(framework)
+{
+    memset(tasks, 0, sizeof(tasks));
+    task_count = 0;
+    stop_time_us = 0;
+}
+
+int TaskScheduler::add_periodic_task(void (*task)(void *context), void *context, uint32_t period_us)
+{
+    if(period_us == 0){
+        return -1;
+    }
+    return add_task(task, context, period_us);
+}
+
+int TaskScheduler::add_deadline_task(void (*task)(void *context), void *context)
+{
+    return add_task(task, context, 0);
+}
+
+int TaskScheduler::add_task(void (*task)(void *context), void *context, uint32_t period_us)
+{
+    if(task_count >= TASK_SCHEDULER_MAX_TASKS){
+        return -1;
+    }
+
+    task_t *entry = &tasks[task_count];
+    entry->function = task;
+    entry->context = context;
+    entry->period_us = period_us;
+    entry->release_time = get_time() + period_us;
+    entry->deadline = entry->release_time + period_us;
+    entry->released = false;
+    memset(&entry->stats, 0, sizeof(task_stats_t));
+    return task_count++;
+}
+
+void TaskScheduler::schedule(int id, uint32_t deadline_us)
+{
+    if(id < 0 || id >= task_count || tasks[id].period_us != 0){
+        return;
+    }
+
+    // Deadline set before the release, the main loop never sees a released task with an old deadline
+    tasks[id].deadline = get_time() + deadline_us;
+    tasks[id].released = true;
+}
+
+uint32_t TaskScheduler::run_once()
+{
+    // I2C first, a task only runs between two services
+    framework.loop_iteration();
+
+    uint32_t now = get_time();
+    release_tasks(now);
+
+    // Earliest deadline first
+    task_t *next = nullptr;
+    for(int i = 0; i < task_count; i++){
+        if(tasks[i].released && (next == nullptr || (int32_t) (tasks[i].deadline - next->deadline) < 0)){
+            next = &tasks[i];
+        }
+    }
+    if(next != nullptr){
+        run_task(next);
+        return 0;
+    }
+
+    // Nothing released, wait for the next periodic release
+    uint32_t wait_us = STOP_MAX_TIME_MS * 1000;
+    for(int i = 0; i < task_count; i++){
+        if(tasks[i].period_us != 0 && tasks[i].release_time - now < wait_us){
+            wait_us = tasks[i].release_time - now;
+        }
+    }
+    return wait_us;
+}
+
+void TaskScheduler::run()
+{
+    while(true){
+        uint32_t wait_us = run_once();
+
+        // Stop mode in whole ms only, shorter waits keep polling
+        if(wait_us >= 1000){
+            stop_time_us += framework.idle(wait_us / 1000);
+        }
+    }
+}
+
+uint32_t TaskScheduler::get_time()
+{
+    return us_ticker_read() + stop_time_us;
+}
+
+void TaskScheduler::get_task_stats(int id, task_stats_t *stats)
+{
+    if(id < 0 || id >= task_count){
+        memset(stats, 0, sizeof(task_stats_t));
+        return;
+    }
+    memcpy(stats, &tasks[id].stats, sizeof(task_stats_t));
+}
+
+void TaskScheduler::release_tasks(uint32_t now)
+{
+    for(int i = 0; i < task_count; i++){
+        task_t *task = &tasks[i];
+        if(task->period_us == 0 || (int32_t) (now - task->release_time) < 0){
+            continue;
+        }
+
+        // Releases missed by an overrun are skipped, the phase is kept
+        uint32_t periods = (now - task->release_time) / task->period_us + 1;
+        task->deadline = task->release_time + task->period_us;
+        task->release_time += periods * task->period_us;
+        task->released = true;
+    }
+}
+
+void TaskScheduler::run_task(task_t *task)
+{
+    // Cleared first, a release during the run is kept for the next one
+    task->released = false;
+
+    uint32_t start = us_ticker_read();
+    task->function(task->context);
+    uint32_t duration = us_ticker_read() - start;
+
+    task->stats.run_count++;
+    task->stats.total_time_us += duration;
+    task->stats.last_time_us = duration;
+    if(duration > task->stats.max_time_us){
+        task->stats.max_time_us = duration;
+    }
+    if((int32_t) (get_time() - task->deadline) > 0){
+        task->stats.missed_deadlines++;
+    }
+}